@@ -0,0 +1,196 @@
+/*
+ * TriDist_lanes.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: teng
+ *
+ *  the lane kernels of the batched TriDist, see TriDist_simd.cpp. this file
+ *  is included once per instruction set with TRIDIST_LANES set to the number
+ *  of lanes, TRIDIST_NAMESPACE to a distinct namespace and the instruction set
+ *  enabled with #pragma GCC target, so the vector types are compiled natively
+ *  instead of being split by the generic code. it has no include guard on purpose.
+ */
+
+namespace TRIDIST_NAMESPACE{
+
+#define W TRIDIST_LANES
+
+class TriDistLanes{
+public:
+	typedef float vf __attribute__((vector_size(W*sizeof(float))));
+	typedef int vi __attribute__((vector_size(W*sizeof(int))));
+
+	static inline void splat(vf &v, float s){
+		for(int l=0;l<W;l++){
+			v[l] = s;
+		}
+	}
+
+	// the bits of a where the mask is set, otherwise the bits of b
+	static inline vf select(vi mask, vf a, vf b){
+		return (vf)((mask & (vi)a) | (~mask & (vi)b));
+	}
+
+	static inline void dot(vf &r, const vf a[3], const vf b[3]){
+		r = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+	}
+
+	static inline void cross(vf r[3], const vf a[3], const vf b[3]){
+		r[0] = a[1]*b[2] - a[2]*b[1];
+		r[1] = a[2]*b[0] - a[0]*b[2];
+		r[2] = a[0]*b[1] - a[1]*b[0];
+	}
+
+	// the lane version of SegPoints()
+	static inline void segpoints(vf VEC[3], vf X[3], vf Y[3],
+			const vf P[3], const vf A[3], const vf Q[3], const vf B[3]){
+		vf zero, one;
+		splat(zero, 0.0);
+		splat(one, 1.0);
+
+		vf T[3], TMP[3], D[3], VEC_a[3], VEC_b[3], VEC_ab[3];
+		for(int k=0;k<3;k++){
+			T[k] = Q[k] - P[k];
+		}
+		vf A_dot_A, B_dot_B, A_dot_B, A_dot_T, B_dot_T;
+		dot(A_dot_A, A, A);
+		dot(B_dot_B, B, B);
+		dot(A_dot_B, A, B);
+		dot(A_dot_T, A, T);
+		dot(B_dot_T, B, T);
+
+		vf denom = A_dot_A*B_dot_B - A_dot_B*A_dot_B;
+		vf t = select(denom == zero, zero, (A_dot_T*B_dot_B - B_dot_T*A_dot_B) / denom);
+		vf u = select(B_dot_B == zero, zero, (t*A_dot_B - B_dot_T) / B_dot_B);
+
+		vi u_low = u <= zero;
+		vi u_high = (u >= one) & ~u_low;
+		vi u_mid = ~(u_low | u_high);
+
+		// t is recomputed and clamped if u is not on segment Q,B
+		vf t_ulow = select(A_dot_A == zero, zero, A_dot_T / A_dot_A);
+		vf t_uhigh = select(A_dot_A == zero, zero, (A_dot_B + A_dot_T) / A_dot_A);
+		t = select(u_low, t_ulow, select(u_high, t_uhigh, t));
+
+		vi t_low = t <= zero;
+		vi t_high = (t >= one) & ~t_low;
+		vi t_mid = ~(t_low | t_high);
+
+		for(int k=0;k<3;k++){
+			Y[k] = select(u_low, Q[k], select(u_high, Q[k] + B[k], Q[k] + B[k]*u));
+			X[k] = select(t_low, P[k], select(t_high, P[k] + A[k], P[k] + A[k]*t));
+		}
+
+		// both closest points are vertices or end points
+		// VEC = Y - X
+		// u is clamped while t is on segment P,A
+		for(int k=0;k<3;k++){
+			D[k] = Y[k] - P[k];
+		}
+		cross(TMP, D, A);
+		cross(VEC_a, A, TMP);
+		// t is clamped while u is on segment Q,B
+		for(int k=0;k<3;k++){
+			D[k] = Q[k] - X[k];
+		}
+		cross(TMP, D, B);
+		cross(VEC_b, B, TMP);
+		// both are on the segments
+		cross(VEC_ab, A, B);
+		vf flip;
+		dot(flip, VEC_ab, T);
+		vi neg = flip < zero;
+		for(int k=0;k<3;k++){
+			VEC_ab[k] = select(neg, VEC_ab[k] * -1.0f, VEC_ab[k]);
+		}
+
+		for(int k=0;k<3;k++){
+			VEC[k] = select(u_mid, select(t_mid, VEC_ab[k], VEC_b[k]),
+								   select(t_mid, VEC_a[k], Y[k] - X[k]));
+		}
+	}
+
+	/*
+	 * the lane version of TriDist_seg(). S is the single triangle, T holds
+	 * the W triangles as T[(vertex*3+dimension)*stride+lane]. for each lane,
+	 * mindd is the squared distance and found tells whether it is final
+	 * */
+	static inline void tridist_seg(const float *S, const float *T, size_t stride,
+			float *mindd_out, int *found_out, int *disjoint_out){
+		vf Sp[3][3], Sv[3][3], Tp[3][3], Tv[3][3];
+		for(int v=0;v<3;v++){
+			for(int k=0;k<3;k++){
+				splat(Sp[v][k], S[v*3+k]);
+				splat(Sv[v][k], S[((v+1)%3)*3+k] - S[v*3+k]);
+				memcpy(&Tp[v][k], T + (v*3+k)*stride, sizeof(vf));
+			}
+		}
+		for(int v=0;v<3;v++){
+			for(int k=0;k<3;k++){
+				Tv[v][k] = Tp[(v+1)%3][k] - Tp[v][k];
+			}
+		}
+
+		vf zero, mindd;
+		splat(zero, 0.0);
+		splat(mindd, DBL_MAX);
+		vi found = zero < zero;
+		vi disjoint = found;
+
+		vf VEC[3], P[3], Q[3], V[3], Z[3];
+		vf dd, a, b, p;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				segpoints(VEC, P, Q, Sp[i], Sv[i], Tp[j], Tv[j]);
+				for(int k=0;k<3;k++){
+					V[k] = Q[k] - P[k];
+				}
+				dot(dd, V, V);
+				vi update = (dd <= mindd) & ~found;
+				mindd = select(update, dd, mindd);
+
+				for(int k=0;k<3;k++){
+					Z[k] = Sp[(i+2)%3][k] - P[k];
+				}
+				dot(a, Z, VEC);
+				for(int k=0;k<3;k++){
+					Z[k] = Tp[(j+2)%3][k] - Q[k];
+				}
+				dot(b, Z, VEC);
+
+				vi closest = update & (a <= zero) & (b >= zero);
+				found |= closest;
+
+				dot(p, V, VEC);
+				a = select(a < zero, zero, a);
+				b = select(b > zero, zero, b);
+				disjoint |= update & ~closest & ((p - a + b) > zero);
+			}
+		}
+		memcpy(mindd_out, &mindd, sizeof(vf));
+		memcpy(found_out, &found, sizeof(vi));
+		memcpy(disjoint_out, &disjoint, sizeof(vi));
+	}
+
+	static inline void batch(const float *S, const float *T, size_t stride, size_t num, float *dist){
+		float mindd[W];
+		int found[W];
+		int disjoint[W];
+		tridist_seg(S, T, stride, mindd, found, disjoint);
+		for(size_t l=0;l<num;l++){
+			if(found[l]){
+				dist[l] = sqrt(mindd[l]);
+			}else{
+				float tri[9];
+				for(int k=0;k<9;k++){
+					tri[k] = T[k*stride+l];
+				}
+				dist[l] = TriDist_finish(S, tri, mindd[l], disjoint[l]);
+			}
+		}
+	}
+};
+
+#undef W
+
+}
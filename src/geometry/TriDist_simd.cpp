@@ -0,0 +1,113 @@
+/*
+ * TriDist_simd.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: teng
+ *
+ *  the batched version of TriDist(), which computes the distances between
+ *  one triangle and a block of triangles stored in SoA layout, one lane
+ *  per triangle. coordinate k of triangle l of the block is T[k*stride+l]. the nine segment pairs are checked for all the lanes with
+ *  the same operations in the same order as the scalar TriDist_seg(), the
+ *  branches are turned into lane masks. the rare lanes whose closest points
+ *  are not on the segments are finished by the scalar code, so the results
+ *  are identical to the ones of TriDist().
+ */
+
+#include "geometry.h"
+
+// keep a*b+c as two roundings like the scalar code, the fma unit comes with avx512f
+#pragma GCC optimize ("fp-contract=off")
+
+namespace tdbase{
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define TRIDIST_LANES 8
+#define TRIDIST_NAMESPACE tridist_avx2
+#include "TriDist_lanes.h"
+#undef TRIDIST_NAMESPACE
+#undef TRIDIST_LANES
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512dq,avx512vl,avx512bw")
+#define TRIDIST_LANES 16
+#define TRIDIST_NAMESPACE tridist_avx512
+#include "TriDist_lanes.h"
+#undef TRIDIST_NAMESPACE
+#undef TRIDIST_LANES
+#pragma GCC pop_options
+
+static void TriDist_batch_avx2(const float *S, const float *T, size_t stride, size_t num, float *dist){
+	tridist_avx2::TriDistLanes::batch(S, T, stride, num, dist);
+}
+
+static void TriDist_batch_avx512(const float *S, const float *T, size_t stride, size_t num, float *dist){
+	tridist_avx512::TriDistLanes::batch(S, T, stride, num, dist);
+}
+
+static void TriDist_batch_scalar(const float *S, const float *T, size_t stride, size_t num, float *dist){
+	for(size_t l=0;l<num;l++){
+		float tri[9];
+		for(int k=0;k<9;k++){
+			tri[k] = T[k*stride+l];
+		}
+		dist[l] = TriDist(S, tri);
+	}
+}
+
+typedef void (*TriDist_batch_func)(const float *, const float *, size_t, size_t, float *);
+
+struct TriDist_dispatcher{
+	TriDist_batch_func func = TriDist_batch_scalar;
+	int width = 1;
+	TriDist_dispatcher(){
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+				&& __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw")){
+			func = TriDist_batch_avx512;
+			width = 16;
+		}else if(__builtin_cpu_supports("avx2")){
+			func = TriDist_batch_avx2;
+			width = 8;
+		}
+	}
+};
+
+static TriDist_dispatcher &get_dispatcher(){
+	static TriDist_dispatcher dispatcher;
+	return dispatcher;
+}
+
+static bool simd_enabled = true;
+
+void TriDist_enable_simd(bool enable){
+	simd_enabled = enable;
+}
+
+int TriDist_batch_width(){
+	return simd_enabled ? get_dispatcher().width : 1;
+}
+
+void TriDist_transpose(const float *T, size_t num, size_t stride, float *T_soa){
+	assert(num>0);
+	const size_t padded = (num+TRIDIST_MAX_WIDTH-1)/TRIDIST_MAX_WIDTH*TRIDIST_MAX_WIDTH;
+	assert(padded<=stride);
+	for(size_t t=0;t<padded;t++){
+		// pad the last block with the last triangle
+		const float *tri = T + min(t, num-1)*9;
+		for(int k=0;k<9;k++){
+			T_soa[k*stride+t] = tri[k];
+		}
+	}
+}
+
+void TriDist_batch(const float *S, const float *T, size_t stride, size_t num, float *dist){
+	if(simd_enabled){
+		get_dispatcher().func(S, T, stride, num, dist);
+	}else{
+		TriDist_batch_scalar(S, T, stride, num, dist);
+	}
+}
+
+}
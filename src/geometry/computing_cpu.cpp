@@ -47,6 +47,7 @@
 //--------------------------------------------------------------------------
 
 #include <pthread.h>
+#include <algorithm>
 #include "geometry.h"
 
 namespace tdbase{
@@ -421,10 +422,20 @@ float TriDist(const float *S, const float *T)
 		//    triangle points are nearly colinear or coincident, one
 		//    of above tests might fail even though the edges tested
 		//    contain the closest points.
-		float mindd_other = TriDist_other(S, T, shown_disjoint);
-		if(mindd_other != -1){ // is the case
-			return mindd_other;
-		}
+		return TriDist_finish(S, T, mindd_seg, shown_disjoint);
+	}
+}
+
+/*
+ * finish the distance calculation if the closest points cannot
+ * be found on the segment pairs. mindd_seg is the squared minimum
+ * distance of the segment pairs
+ * */
+float TriDist_finish(const float *S, const float *T, float mindd_seg, bool shown_disjoint)
+{
+	float mindd_other = TriDist_other(S, T, shown_disjoint);
+	if(mindd_other != -1){ // is the case
+		return mindd_other;
 	}
 
 	// Case 1 can't be shown.
@@ -438,88 +449,679 @@ float TriDist(const float *S, const float *T)
 	}
 }
 
-result_container MeshDist(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1, const float *hausdorff2){
+/*
+ * transpose the triangles of a mesh into the SoA layout of the batched
+ * TriDist kernel, the buffer is kept by each thread and reused
+ * */
+static const float *transpose_triangles(const float *data, size_t size, size_t &stride){
+	static thread_local vector<float> rows;
+	stride = (size+TRIDIST_MAX_WIDTH-1)/TRIDIST_MAX_WIDTH*TRIDIST_MAX_WIDTH;
+	if(rows.size() < 9*stride){
+		rows.resize(9*stride);
+	}
+	if(size>0){
+		TriDist_transpose(data, size, stride, rows.data());
+	}
+	return rows.data();
+}
+
+/*
+ * the triangles and hausdorff distances of a voxel in either packing,
+ * coordinate k of triangle i is tri[i*tri_step+k*coord_step], its proxy
+ * hausdorff and hausdorff distances are haus[i*haus_step] and
+ * haus[i*haus_step+haus_offset]
+ * */
+struct triangle_view{
+	const float *tri;
+	size_t tri_step;
+	size_t coord_step;
+	const float *haus;
+	size_t haus_step;
+	size_t haus_offset;
+
+	inline void get_triangle(size_t i, float *T) const{
+		for(int k=0;k<9;k++){
+			T[k] = tri[i*tri_step+k*coord_step];
+		}
+	}
+	inline float proxy_hausdorff(size_t i) const{
+		return haus ? haus[i*haus_step] : 0;
+	}
+	inline float hausdorff(size_t i) const{
+		return haus ? haus[i*haus_step+haus_offset] : 0;
+	}
+};
+
+inline void triangle_box(const float *T, float *box){
+	for(int k=0;k<3;k++){
+		box[k] = min(T[k], min(T[3+k], T[6+k]));
+		box[3+k] = max(T[k], max(T[3+k], T[6+k]));
+	}
+}
+
+// the distance between two boxes, a lower bound of the distance between their contents
+inline float box_distance(const float *b1, const float *b2){
+	float dd = 0;
+	for(int k=0;k<3;k++){
+		float gap = max(b1[k]-b2[3+k], b2[k]-b1[3+k]);
+		if(gap > 0){
+			dd += gap*gap;
+		}
+	}
+	return sqrt(dd);
+}
+
+/*
+ * the distances between the triangles of v1 and the ones of v2, which
+ * are also provided as the rows of the batched kernel.
+ *
+ * with a bound, the caller only cares about the distances under it, so the
+ * triangle pairs whose lower bound (the distance between the triangle boxes
+ * minus the proxy hausdorff distances) is larger than the bound are skipped.
+ * the skipped pairs can only affect the results which are already larger than
+ * the bound. if some skipped pair may be closer than the evaluated ones, the
+ * result is marked as bounded: distance is then only the minimum over the
+ * evaluated pairs, and min_dist keeps a valid lower bound. with
+ * stop_under_bound, the computation stops once a pair whose upper bound is
+ * within the bound is found, the result is then bounded with min_dist zero
+ * */
+static result_container MeshDist_rows(const triangle_view &v1, const triangle_view &v2,
+		const float *rows2, size_t stride2, size_t size1, size_t size2,
+		float bound, bool stop_under_bound){
 	result_container ret;
 	ret.distance = DBL_MAX;
 	ret.min_dist = DBL_MAX;
 	ret.max_dist = DBL_MAX;
-	for(size_t i=0;i<size1;i++){
+	ret.bounded = false;
+	const bool with_hausdorff = v1.haus != NULL && v2.haus != NULL;
+	const bool bounded = bound < FLT_MAX;
+
+	// the boxes of the triangles in v2 and the box of v2
+	static thread_local vector<float> boxes2;
+	float box2[6];
+	float max_phdist2 = 0;
+	if(bounded){
+		if(boxes2.size() < 6*size2){
+			boxes2.resize(6*size2);
+		}
+		float T[9];
 		for(size_t j=0;j<size2;j++){
-			// get distance of current triangle pair
-			// each triangle contains three points
-			float dist = TriDist(data1+i*9, data2+j*9);
-			if(dist < ret.distance){
-				ret.distance = dist;
-				ret.p1 = i;
-				ret.p2 = j;
+			v2.get_triangle(j, T);
+			triangle_box(T, boxes2.data()+6*j);
+			for(int k=0;k<3;k++){
+				box2[k] = j==0 ? boxes2[6*j+k] : min(box2[k], boxes2[6*j+k]);
+				box2[3+k] = j==0 ? boxes2[6*j+3+k] : max(box2[3+k], boxes2[6*j+3+k]);
 			}
+			max_phdist2 = max(max_phdist2, v2.proxy_hausdorff(j));
+		}
+	}
+	// the smallest lower bounds of the skipped triangle pairs
+	float skipped_min_dist = DBL_MAX;
+	float skipped_distance = DBL_MAX;
 
-			if(hausdorff1 == NULL || hausdorff2 == NULL){
+	const int width = TriDist_batch_width();
+	float block_dist[TRIDIST_MAX_WIDTH];
+	bool skipped[TRIDIST_MAX_WIDTH];
+	for(size_t i=0;i<size1;i++){
+		float S[9];
+		v1.get_triangle(i, S);
+		const float phdist1 = v1.proxy_hausdorff(i);
+		const float hdist1 = v1.hausdorff(i);
+		float box1[6];
+		if(bounded){
+			triangle_box(S, box1);
+			// all the triangles of v2 are too far from this one
+			const float lb = box_distance(box1, box2);
+			if(lb - phdist1 - max_phdist2 > bound){
+				skipped_min_dist = min(skipped_min_dist, max(lb - phdist1 - max_phdist2, (float)0.0));
+				skipped_distance = min(skipped_distance, lb);
 				continue;
 			}
+		}
+		for(size_t jb=0;jb<size2;jb+=width){
+			const size_t num = min((size_t)width, size2-jb);
+			if(bounded){
+				bool all_skipped = true;
+				for(size_t l=0;l<num;l++){
+					const size_t j = jb+l;
+					const float lb = box_distance(box1, boxes2.data()+6*j);
+					const float low = lb - phdist1 - v2.proxy_hausdorff(j);
+					skipped[l] = low > bound;
+					if(skipped[l]){
+						skipped_min_dist = min(skipped_min_dist, max(low, (float)0.0));
+						skipped_distance = min(skipped_distance, lb);
+					}else{
+						all_skipped = false;
+					}
+				}
+				if(all_skipped){
+					continue;
+				}
+			}
+			TriDist_batch(S, rows2+jb, stride2, num, block_dist);
+			for(size_t l=0;l<num;l++){
+				if(bounded && skipped[l]){
+					continue;
+				}
+				const size_t j = jb+l;
+				const float dist = block_dist[l];
+				if(dist < ret.distance){
+					ret.distance = dist;
+					ret.p1 = i;
+					ret.p2 = j;
+				}
+				if(!with_hausdorff){
+					continue;
+				}
+				// with hausdorff distances under consideration
+				float low_dist = std::max(dist-phdist1-v2.proxy_hausdorff(j), (float)0.0);
+				float high_dist = dist+hdist1+v2.hausdorff(j);
+				ret.min_dist = min(ret.min_dist, low_dist);
+				ret.max_dist = min(ret.max_dist, high_dist);
+			}
+			if(stop_under_bound && (with_hausdorff ? ret.max_dist : ret.distance) <= bound){
+				ret.min_dist = 0;
+				ret.bounded = true;
+				return ret;
+			}
+		}
+	}
+	if(bounded){
+		if(with_hausdorff){
+			ret.min_dist = min(ret.min_dist, skipped_min_dist);
+		}
+		if(skipped_distance < ret.distance){
+			ret.bounded = true;
+			if(!with_hausdorff){
+				ret.min_dist = skipped_distance;
+			}
+		}
+	}
+	return ret;
+}
 
-			// with hausdorff distances under consideration
-			float phdist1 = *(hausdorff1+2*i);
-			float phdist2 = *(hausdorff2+2*j);
-			float hdist1 = *(hausdorff1+2*i+1);
-			float hdist2 = *(hausdorff2+2*j+1);
+result_container MeshDist(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1, const float *hausdorff2, float bound, bool stop_under_bound){
+	// the triangles of data2 are evaluated in blocks by the batched kernel
+	size_t stride;
+	const float *rows = transpose_triangles(data2, size2, stride);
+	triangle_view v1 = {data1, 9, 1, hausdorff1, 2, 1};
+	triangle_view v2 = {data2, 9, 1, hausdorff2, 2, 1};
+	return MeshDist_rows(v1, v2, rows, stride, size1, size2, bound, stop_under_bound);
+}
 
-			float low_dist = std::max(dist-phdist1-phdist2, (float)0.0);
-			float high_dist = dist+hdist1+hdist2;
-			ret.min_dist = min(ret.min_dist, low_dist);
-			ret.max_dist = min(ret.max_dist, high_dist);
+result_container MeshDist(const float *data1, const float *data2, size_t size1, size_t size2, size_t stride, const float *hausdorff1, const float *hausdorff2, float bound, bool stop_under_bound){
+	// the triangles of data2 are streamed from the rows directly
+	triangle_view v1 = {data1, 1, stride, hausdorff1, 1, stride};
+	triangle_view v2 = {data2, 1, stride, hausdorff2, 1, stride};
+	return MeshDist_rows(v1, v2, data2, stride, size1, size2, bound, stop_under_bound);
+}
 
-//			const float *tdata1 = data1+i*9;
-//			const float *tdata2 = data2+j*9;
-//			printf("(%f %f %f, %f %f %f, %f %f %f) (%f %f %f, %f %f %f, %f %f %f) %f\n"
-//					,*tdata1,*(tdata1+1),*(tdata1+2),*(tdata1+3),*(tdata1+4),*(tdata1+5),*(tdata1+6),*(tdata1+7),*(tdata1+8)
-//					,*tdata2,*(tdata2+1),*(tdata2+2),*(tdata2+3),*(tdata2+4),*(tdata2+5),*(tdata2+6),*(tdata2+7),*(tdata2+8)
-//					,dist);
+inline bool box_overlap(const float *b1, const float *b2){
+	for(int k=0;k<3;k++){
+		if(b1[k] > b2[3+k] || b2[k] > b1[3+k]){
+			return false;
 		}
 	}
-	return ret;
+	return true;
 }
 
-result_container MeshInt(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1, const float *hausdorff2){
+/*
+ * the boxes of both sides are sorted by their lower ends along the axis and
+ * swept, the box with the lower end goes against the boxes of the other side
+ * which start before it ends. visit(i, j) is called for each overlapping pair
+ * of box i of the first side and box j of the second one, until it returns true
+ * */
+template<class F>
+static bool sweep_boxes(const float *b1, const uint32_t *order1, size_t size1,
+		const float *b2, const uint32_t *order2, size_t size2, int axis, F visit){
+	size_t i = 0, j = 0;
+	while(i < size1 && j < size2){
+		const bool from1 = b1[6*order1[i]+axis] <= b2[6*order2[j]+axis];
+		const uint32_t cur = from1 ? order1[i] : order2[j];
+		const float *box = from1 ? b1+6*cur : b2+6*cur;
+		const float *others = from1 ? b2 : b1;
+		const uint32_t *other_order = from1 ? order2 : order1;
+		const size_t other_size = from1 ? size2 : size1;
+		for(size_t o = from1 ? j : i; o < other_size; o++){
+			const uint32_t other = other_order[o];
+			const float *obox = others+6*other;
+			if(obox[axis] > box[3+axis]){
+				break;
+			}
+			if(!box_overlap(box, obox)){
+				continue;
+			}
+			if(from1 ? visit(cur, other) : visit(other, cur)){
+				return true;
+			}
+		}
+		if(from1){
+			i++;
+		}else{
+			j++;
+		}
+	}
+	return false;
+}
+
+/*
+ * check whether any triangle of v1 intersects with any triangle of v2.
+ * the triangle boxes of both sides are swept along the longest axis, only
+ * the pairs with overlapping boxes are tested. as in the other MeshInt
+ * kernels, the triangles intersect if TriInt tells so, or with the hausdorff
+ * distances, if their distance is zero.
+ *
+ * with the hausdorff distances, the lower bound of the distance between the
+ * two voxels (distance minus the proxy hausdorff distances) is evaluated in
+ * the same sweep. the boxes are then expanded by the proxy hausdorff distance
+ * of each triangle plus half of the radius, the largest sum of the proxy
+ * hausdorff distances, so the pairs out of the sweep are farther than the
+ * radius. the exact TriDist is computed only for the swept pairs whose
+ * box-based lower bound cannot tell it is positive, others contribute their
+ * box-based lower bounds. the result is a valid lower bound, exact when it is
+ * not positive, and no larger than the radius
+ * */
+static result_container MeshInt_sweep(const triangle_view &v1, const triangle_view &v2, size_t size1, size_t size2){
 	result_container res;
 	res.intersected = false;
-
 	res.distance = DBL_MAX;
-
-	if(!hausdorff1 || !hausdorff2){
+	res.min_dist = DBL_MAX;
+	res.max_dist = DBL_MAX;
+	res.bounded = false;
+	if(size1 == 0 || size2 == 0){
+		return res;
+	}
+	const bool with_hausdorff = v1.haus != NULL && v2.haus != NULL;
+
+	// the triangle boxes, followed by the swept ones with the hausdorff distances
+	static thread_local vector<float> boxes1;
+	static thread_local vector<float> boxes2;
+	static thread_local vector<uint32_t> order1;
+	static thread_local vector<uint32_t> order2;
+	const size_t width = with_hausdorff ? 12 : 6;
+	if(boxes1.size() < width*size1){
+		boxes1.resize(width*size1);
+	}
+	if(boxes2.size() < width*size2){
+		boxes2.resize(width*size2);
+	}
+	if(order1.size() < size1){
+		order1.resize(size1);
+	}
+	if(order2.size() < size2){
+		order2.resize(size2);
+	}
+	float T[9];
+	float max_phdist1 = 0, max_phdist2 = 0;
+	for(size_t i=0;i<size1;i++){
+		v1.get_triangle(i, T);
+		triangle_box(T, boxes1.data()+6*i);
+		order1[i] = i;
+		max_phdist1 = max(max_phdist1, v1.proxy_hausdorff(i));
+	}
+	for(size_t j=0;j<size2;j++){
+		v2.get_triangle(j, T);
+		triangle_box(T, boxes2.data()+6*j);
+		order2[j] = j;
+		max_phdist2 = max(max_phdist2, v2.proxy_hausdorff(j));
+	}
+	const float *b1 = boxes1.data();
+	const float *b2 = boxes2.data();
+	const float radius = max_phdist1 + max_phdist2;
+	const float *s1 = b1;
+	const float *s2 = b2;
+	if(with_hausdorff){
+		float *e1 = boxes1.data()+6*size1;
+		float *e2 = boxes2.data()+6*size2;
 		for(size_t i=0;i<size1;i++){
-			for(size_t j=0;j<size2;j++){
-				if(TriInt(data1+9*i, data2+9*j)){
-					res.intersected = true;
-					res.p1 = i;
-					res.p2 = j;
-					return res;
-				}
+			const float ext = v1.proxy_hausdorff(i) + radius/2;
+			for(int k=0;k<3;k++){
+				e1[6*i+k] = b1[6*i+k] - ext;
+				e1[6*i+3+k] = b1[6*i+3+k] + ext;
 			}
 		}
-		return res;
+		for(size_t j=0;j<size2;j++){
+			const float ext = v2.proxy_hausdorff(j) + radius/2;
+			for(int k=0;k<3;k++){
+				e2[6*j+k] = b2[6*j+k] - ext;
+				e2[6*j+3+k] = b2[6*j+3+k] + ext;
+			}
+		}
+		s1 = e1;
+		s2 = e2;
 	}
 
+	float extent[6];
+	for(int k=0;k<3;k++){
+		extent[k] = FLT_MAX;
+		extent[3+k] = -FLT_MAX;
+	}
 	for(size_t i=0;i<size1;i++){
-		for(size_t j=0;j<size2;j++){
-			float dist = TriDist(data1+9*i, data2+9*j);
-			float phdist1 = 0;
-			float phdist2 = 0;
-			if(hausdorff1 != NULL && hausdorff2 != NULL){
-				phdist1 = *(hausdorff1+2*i);
-				phdist2 = *(hausdorff2+2*j);
+		for(int k=0;k<3;k++){
+			extent[k] = min(extent[k], s1[6*i+k]);
+			extent[3+k] = max(extent[3+k], s1[6*i+3+k]);
+		}
+	}
+	for(size_t j=0;j<size2;j++){
+		for(int k=0;k<3;k++){
+			extent[k] = min(extent[k], s2[6*j+k]);
+			extent[3+k] = max(extent[3+k], s2[6*j+3+k]);
+		}
+	}
+	int axis = 0;
+	for(int k=1;k<3;k++){
+		if(extent[3+k]-extent[k] > extent[3+axis]-extent[axis]){
+			axis = k;
+		}
+	}
+	std::sort(order1.begin(), order1.begin()+size1, [s1, axis](uint32_t x, uint32_t y){
+		return s1[6*x+axis] < s1[6*y+axis];
+	});
+	std::sort(order2.begin(), order2.begin()+size2, [s2, axis](uint32_t x, uint32_t y){
+		return s2[6*x+axis] < s2[6*y+axis];
+	});
+
+	// the triangles last loaded on both sides
+	float S[9];
+	uint32_t loaded1 = UINT32_MAX, loaded2 = UINT32_MAX;
+	auto load = [&](uint32_t i, uint32_t j){
+		if(i != loaded1){
+			v1.get_triangle(i, S);
+			loaded1 = i;
+		}
+		if(j != loaded2){
+			v2.get_triangle(j, T);
+			loaded2 = j;
+		}
+	};
+	auto intersected = [&](uint32_t i, uint32_t j){
+		res.intersected = true;
+		res.p1 = i;
+		res.p2 = j;
+		res.distance = -v1.proxy_hausdorff(i)-v2.proxy_hausdorff(j);
+		res.min_dist = 0;
+		return true;
+	};
+	if(!with_hausdorff){
+		sweep_boxes(s1, order1.data(), size1, s2, order2.data(), size2, axis, [&](uint32_t i, uint32_t j){
+			load(i, j);
+			return TriInt(S, T) && intersected(i, j);
+		});
+		return res;
+	}
+	if(sweep_boxes(s1, order1.data(), size1, s2, order2.data(), size2, axis, [&](uint32_t i, uint32_t j){
+			const float phdist1 = v1.proxy_hausdorff(i);
+			const float phdist2 = v2.proxy_hausdorff(j);
+			float low = box_distance(b1+6*i, b2+6*j) - phdist1 - phdist2;
+			if(low <= 0){
+				load(i, j);
+				const float dist = TriDist(S, T);
+				if(dist == 0){
+					return intersected(i, j);
+				}
+				low = dist - phdist1 - phdist2;
 			}
-			res.distance = min(res.distance, dist - phdist1 - phdist2);
+			res.distance = min(res.distance, low);
+			return false;
+		})){
+		return res;
+	}
+	res.distance = min(res.distance, radius);
+	res.min_dist = max(res.distance, (float)0.0);
+	return res;
+}
+
+result_container MeshInt(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1, const float *hausdorff2){
+	triangle_view v1 = {data1, 9, 1, hausdorff1, 2, 1};
+	triangle_view v2 = {data2, 9, 1, hausdorff2, 2, 1};
+	return MeshInt_sweep(v1, v2, size1, size2);
+}
+
+result_container MeshInt(const float *data1, const float *data2, size_t size1, size_t size2, size_t stride, const float *hausdorff1, const float *hausdorff2){
+	triangle_view v1 = {data1, 1, stride, hausdorff1, 1, stride};
+	triangle_view v2 = {data2, 1, stride, hausdorff2, 1, stride};
+	return MeshInt_sweep(v1, v2, size1, size2);
+}
+
+/*
+ * the node pairs of the dual-tree traversals, kept by each thread
+ * */
+static vector<pair<uint32_t, uint32_t>> &bvh_stack(){
+	static thread_local vector<pair<uint32_t, uint32_t>> stack;
+	stack.clear();
+	return stack;
+}
+
+// split the node with more triangles unless it is a leaf
+inline bool bvh_split_first(const bvh_node &n1, const bvh_node &n2){
+	return !n1.is_leaf() && (n2.is_leaf() || n1.count >= n2.count);
+}
+
+static triangle_view bvh_view(const float *data, size_t stride, const float *hausdorff){
+	if(stride == 0){
+		triangle_view v = {data, 9, 1, hausdorff, 2, 1};
+		return v;
+	}
+	triangle_view v = {data, 1, stride, hausdorff, 1, stride};
+	return v;
+}
 
-			if(dist==0) {
-				res.intersected = true;
-				res.p1 = i;
-				res.p2 = j;
-				return res;
+/*
+ * the dual-tree version of MeshDist_rows(). a node pair is skipped when no
+ * triangle pair under it can improve any of the results: the distance
+ * between the node boxes is no smaller than the current distance, and with
+ * the hausdorff distances, its lower and upper bounds derived from the node
+ * boxes cannot improve min_dist and max_dist either. the nearer child pair
+ * is visited first to tighten the results early. the bound and
+ * stop_under_bound are handled the same as MeshDist_rows(), with the lower
+ * bounds of the skipped node pairs
+ * */
+result_container MeshDist_bvh(const float *data1, const float *data2, size_t stride, const triangle_bvh *tree1, const triangle_bvh *tree2,
+		const float *hausdorff1, const float *hausdorff2, float bound, bool stop_under_bound){
+	result_container ret;
+	ret.distance = DBL_MAX;
+	ret.min_dist = DBL_MAX;
+	ret.max_dist = DBL_MAX;
+	ret.bounded = false;
+	if(tree1->size() == 0 || tree2->size() == 0){
+		return ret;
+	}
+	const triangle_view v1 = bvh_view(data1, stride, hausdorff1);
+	const triangle_view v2 = bvh_view(data2, stride, hausdorff2);
+	const bool with_hausdorff = hausdorff1 != NULL && hausdorff2 != NULL;
+	const bool bounded = bound < FLT_MAX;
+	float skipped_min_dist = DBL_MAX;
+	float skipped_distance = DBL_MAX;
+
+	const bvh_node *nodes1 = tree1->nodes.data();
+	const bvh_node *nodes2 = tree2->nodes.data();
+	vector<pair<uint32_t, uint32_t>> &stack = bvh_stack();
+	stack.push_back(pair<uint32_t, uint32_t>(0, 0));
+	float S[9], T[9];
+	while(!stack.empty()){
+		const pair<uint32_t, uint32_t> np = stack.back();
+		stack.pop_back();
+		const bvh_node &n1 = nodes1[np.first];
+		const bvh_node &n2 = nodes2[np.second];
+		const float lb = box_distance(n1.box, n2.box);
+		const float low = lb - n1.max_phdist - n2.max_phdist;
+		if(bounded && low > bound){
+			skipped_min_dist = min(skipped_min_dist, max(low, (float)0.0));
+			skipped_distance = min(skipped_distance, lb);
+			continue;
+		}
+		if(lb >= ret.distance &&
+			(!with_hausdorff || (max(low, (float)0.0) >= ret.min_dist && lb + n1.min_hdist + n2.min_hdist >= ret.max_dist))){
+			continue;
+		}
+		if(n1.is_leaf() && n2.is_leaf()){
+			for(uint32_t a=n1.first;a<n1.first+n1.count;a++){
+				const uint32_t i = tree1->order[a];
+				v1.get_triangle(i, S);
+				const float phdist1 = v1.proxy_hausdorff(i);
+				const float hdist1 = v1.hausdorff(i);
+				for(uint32_t b=n2.first;b<n2.first+n2.count;b++){
+					const uint32_t j = tree2->order[b];
+					v2.get_triangle(j, T);
+					const float dist = TriDist(S, T);
+					if(dist < ret.distance){
+						ret.distance = dist;
+						ret.p1 = i;
+						ret.p2 = j;
+					}
+					if(!with_hausdorff){
+						continue;
+					}
+					float low_dist = std::max(dist-phdist1-v2.proxy_hausdorff(j), (float)0.0);
+					float high_dist = dist+hdist1+v2.hausdorff(j);
+					ret.min_dist = min(ret.min_dist, low_dist);
+					ret.max_dist = min(ret.max_dist, high_dist);
+				}
+			}
+			if(stop_under_bound && (with_hausdorff ? ret.max_dist : ret.distance) <= bound){
+				ret.min_dist = 0;
+				ret.bounded = true;
+				return ret;
+			}
+			continue;
+		}
+		pair<uint32_t, uint32_t> c1, c2;
+		if(bvh_split_first(n1, n2)){
+			c1 = pair<uint32_t, uint32_t>(np.first+1, np.second);
+			c2 = pair<uint32_t, uint32_t>(n1.right, np.second);
+		}else{
+			c1 = pair<uint32_t, uint32_t>(np.first, np.second+1);
+			c2 = pair<uint32_t, uint32_t>(np.first, n2.right);
+		}
+		// the nearer child pair goes on top
+		if(box_distance(nodes1[c1.first].box, nodes2[c1.second].box) <
+		   box_distance(nodes1[c2.first].box, nodes2[c2.second].box)){
+			stack.push_back(c2);
+			stack.push_back(c1);
+		}else{
+			stack.push_back(c1);
+			stack.push_back(c2);
+		}
+	}
+	if(bounded){
+		if(with_hausdorff){
+			ret.min_dist = min(ret.min_dist, skipped_min_dist);
+		}
+		if(skipped_distance < ret.distance){
+			ret.bounded = true;
+			if(!with_hausdorff){
+				ret.min_dist = skipped_distance;
+			}
+		}
+	}
+	return ret;
+}
+
+/*
+ * the dual-tree version of MeshInt_sweep(), only the node pairs with
+ * overlapping boxes are visited for the exact tests, which are the same as
+ * in MeshInt_sweep(). the lower bound with the hausdorff distances follows
+ * MeshInt_sweep() as well, the node pairs whose lower bound is positive
+ * contribute that bound only
+ * */
+result_container MeshInt_bvh(const float *data1, const float *data2, size_t stride, const triangle_bvh *tree1, const triangle_bvh *tree2,
+		const float *hausdorff1, const float *hausdorff2){
+	result_container res;
+	res.intersected = false;
+	res.distance = DBL_MAX;
+	res.min_dist = DBL_MAX;
+	res.max_dist = DBL_MAX;
+	res.bounded = false;
+	if(tree1->size() == 0 || tree2->size() == 0){
+		return res;
+	}
+	const triangle_view v1 = bvh_view(data1, stride, hausdorff1);
+	const triangle_view v2 = bvh_view(data2, stride, hausdorff2);
+	const bool with_hausdorff = hausdorff1 != NULL && hausdorff2 != NULL;
+	const bvh_node *nodes1 = tree1->nodes.data();
+	const bvh_node *nodes2 = tree2->nodes.data();
+	vector<pair<uint32_t, uint32_t>> &stack = bvh_stack();
+	float S[9], T[9];
+	float box1[6], box2[6];
+
+	stack.push_back(pair<uint32_t, uint32_t>(0, 0));
+	while(!stack.empty()){
+		const pair<uint32_t, uint32_t> np = stack.back();
+		stack.pop_back();
+		const bvh_node &n1 = nodes1[np.first];
+		const bvh_node &n2 = nodes2[np.second];
+		if(!box_overlap(n1.box, n2.box)){
+			continue;
+		}
+		if(n1.is_leaf() && n2.is_leaf()){
+			for(uint32_t a=n1.first;a<n1.first+n1.count;a++){
+				const uint32_t i = tree1->order[a];
+				v1.get_triangle(i, S);
+				triangle_box(S, box1);
+				for(uint32_t b=n2.first;b<n2.first+n2.count;b++){
+					const uint32_t j = tree2->order[b];
+					v2.get_triangle(j, T);
+					triangle_box(T, box2);
+					if(box_overlap(box1, box2) && (with_hausdorff ? TriDist(S, T) == 0 : TriInt(S, T))){
+						res.intersected = true;
+						res.p1 = i;
+						res.p2 = j;
+						res.distance = -v1.proxy_hausdorff(i)-v2.proxy_hausdorff(j);
+						res.min_dist = 0;
+						return res;
+					}
+				}
 			}
+		}else if(bvh_split_first(n1, n2)){
+			stack.push_back(pair<uint32_t, uint32_t>(n1.right, np.second));
+			stack.push_back(pair<uint32_t, uint32_t>(np.first+1, np.second));
+		}else{
+			stack.push_back(pair<uint32_t, uint32_t>(np.first, n2.right));
+			stack.push_back(pair<uint32_t, uint32_t>(np.first, np.second+1));
 		}
 	}
 
+	if(!with_hausdorff){
+		return res;
+	}
+	stack.push_back(pair<uint32_t, uint32_t>(0, 0));
+	while(!stack.empty()){
+		const pair<uint32_t, uint32_t> np = stack.back();
+		stack.pop_back();
+		const bvh_node &n1 = nodes1[np.first];
+		const bvh_node &n2 = nodes2[np.second];
+		const float low = box_distance(n1.box, n2.box) - n1.max_phdist - n2.max_phdist;
+		if(low > 0 || low >= res.distance){
+			res.distance = min(res.distance, low);
+			continue;
+		}
+		if(n1.is_leaf() && n2.is_leaf()){
+			for(uint32_t a=n1.first;a<n1.first+n1.count;a++){
+				const uint32_t i = tree1->order[a];
+				v1.get_triangle(i, S);
+				triangle_box(S, box1);
+				const float phdist1 = v1.proxy_hausdorff(i);
+				for(uint32_t b=n2.first;b<n2.first+n2.count;b++){
+					const uint32_t j = tree2->order[b];
+					const float phdist2 = v2.proxy_hausdorff(j);
+					v2.get_triangle(j, T);
+					triangle_box(T, box2);
+					float low = box_distance(box1, box2) - phdist1 - phdist2;
+					if(low <= 0){
+						low = TriDist(S, T) - phdist1 - phdist2;
+					}
+					res.distance = min(res.distance, low);
+				}
+			}
+		}else if(bvh_split_first(n1, n2)){
+			stack.push_back(pair<uint32_t, uint32_t>(n1.right, np.second));
+			stack.push_back(pair<uint32_t, uint32_t>(np.first+1, np.second));
+		}else{
+			stack.push_back(pair<uint32_t, uint32_t>(np.first, n2.right));
+			stack.push_back(pair<uint32_t, uint32_t>(np.first, np.second+1));
+		}
+	}
+	res.min_dist = max(res.distance, (float)0.0);
 	return res;
 }
 
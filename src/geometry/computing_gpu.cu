@@ -640,6 +640,7 @@ void clear_resultset(result_container *result, uint32_t pairnum){
 	result[id].intersected = 0;
 	result[id].min_dist = DBL_MAX;
 	result[id].max_dist = DBL_MAX;
+	result[id].bounded = false;
 }
 
 void TriInt_batch_gpu(gpu_info *gpu, const float *data, const uint32_t *offset_size, const float *hausdorff, 
@@ -5,6 +5,7 @@
  *      Author: teng
  */
 
+#include <sys/mman.h>
 #include "geometry.h"
 #include "mygpu.h"
 #include "query_context.h"
@@ -12,19 +13,171 @@
 
 namespace tdbase{
 
+buffer_arena::buffer_arena(){
+	for(int i=0;i<BUFFER_SLOT_NUM;i++){
+		buffers[i] = NULL;
+		capacity[i] = 0;
+		hugepage[i] = false;
+	}
+}
 
-void *MeshDist_unit(void *params_void){
-	geometry_param *param = (geometry_param *)params_void;
-	for(int i=0;i<param->pair_num;i++){
-		param->results[i] = MeshDist(param->data+param->offset_size[4*i]*9,
-									   param->data+param->offset_size[4*i+2]*9,
-									   param->offset_size[4*i+1],
-									   param->offset_size[4*i+3],
-									   param->hausdorff+param->offset_size[4*i]*2,
-									   param->hausdorff+param->offset_size[4*i+2]*2);
+buffer_arena::~buffer_arena(){
+	for(int i=0;i<BUFFER_SLOT_NUM;i++){
+		release(i);
+	}
+}
 
+void buffer_arena::release(int slot){
+	if(buffers[slot] == NULL){
+		return;
+	}
+	if(hugepage[slot]){
+		munmap(buffers[slot], capacity[slot]);
+	}else{
+		free(buffers[slot]);
+	}
+	buffers[slot] = NULL;
+	capacity[slot] = 0;
+}
+
+void *buffer_arena::get(int slot, size_t bytes, bool use_hugepage){
+	assert(slot>=0 && slot<BUFFER_SLOT_NUM);
+	// use_hugepage only matters for the new buffers
+	if(buffers[slot] && bytes <= capacity[slot]){
+		return buffers[slot];
+	}
+	// grow by half at least, so slowly growing requests do not reallocate each time
+	size_t size = max(bytes, capacity[slot]+capacity[slot]/2);
+	release(slot);
+	hugepage[slot] = false;
+	if(use_hugepage){
+		const size_t mapped = max((size+HUGE_PAGE_SIZE-1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE, HUGE_PAGE_SIZE);
+		void *buffer = mmap(NULL, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if(buffer != MAP_FAILED){
+			// only a hint, the buffer works without huge pages as well
+			madvise(buffer, mapped, MADV_HUGEPAGE);
+			buffers[slot] = buffer;
+			capacity[slot] = mapped;
+			hugepage[slot] = true;
+			return buffer;
+		}
+		log("failed to map %ld bytes, fall back to the regular allocation", mapped);
+	}
+	size = max((size+SOA_ALIGNMENT-1)/SOA_ALIGNMENT*SOA_ALIGNMENT, (size_t)SOA_ALIGNMENT);
+	buffers[slot] = aligned_alloc(SOA_ALIGNMENT, size);
+	assert(buffers[slot]);
+	capacity[slot] = size;
+	return buffers[slot];
+}
+
+buffer_arena &buffer_arena::local(){
+	static thread_local buffer_arena arena;
+	return arena;
+}
+
+
+/*
+ * compute the rows [row_begin, row_end) of the first voxel of pair i
+ * against all the triangles of the second voxel
+ * */
+static result_container compute_pair(const geometry_param &param, uint32_t i, uint32_t row_begin, uint32_t row_end, bool intersect){
+	const uint32_t *os = param.offset_size+4*i;
+	const float bound = param.bounds ? param.bounds[i] : FLT_MAX;
+	result_container res;
+	// the triangles and hausdorff distances of the two voxels,
+	// stride is 0 for the AoS layouts
+	const float *data1, *data2, *hausdorff1, *hausdorff2;
+	size_t stride = 0;
+	if(param.reference){
+		data1 = param.voxel_triangles[os[0]];
+		data2 = param.voxel_triangles[os[2]];
+		hausdorff1 = param.voxel_hausdorff[os[0]];
+		hausdorff2 = param.voxel_hausdorff[os[2]];
+	}else if(param.soa){
+		data1 = param.data+os[0];
+		data2 = param.data+os[2];
+		hausdorff1 = param.hausdorff+os[0];
+		hausdorff2 = param.hausdorff+os[2];
+		stride = param.stride;
+	}else{
+		data1 = param.data+os[0]*9;
+		data2 = param.data+os[2]*9;
+		hausdorff1 = param.hausdorff+os[0]*2;
+		hausdorff2 = param.hausdorff+os[2]*2;
+	}
+	if(param.trees){
+		// the BVHs cover the whole voxels
+		assert(row_begin == 0 && row_end == os[1]);
+		const triangle_bvh *tree1 = param.trees[2*i];
+		const triangle_bvh *tree2 = param.trees[2*i+1];
+		assert(tree1->size() == os[1] && tree2->size() == os[3]);
+		if(intersect){
+			res = MeshInt_bvh(data1, data2, stride, tree1, tree2, hausdorff1, hausdorff2);
+		}else{
+			res = MeshDist_bvh(data1, data2, stride, tree1, tree2, hausdorff1, hausdorff2, bound, param.stop_under_bound);
+		}
+	}else if(stride > 0){
+		data1 += row_begin;
+		hausdorff1 += row_begin;
+		if(intersect){
+			res = MeshInt(data1, data2, row_end-row_begin, os[3], stride, hausdorff1, hausdorff2);
+		}else{
+			res = MeshDist(data1, data2, row_end-row_begin, os[3], stride, hausdorff1, hausdorff2, bound, param.stop_under_bound);
+		}
+	}else{
+		data1 += row_begin*9;
+		hausdorff1 += row_begin*2;
+		if(intersect){
+			res = MeshInt(data1, data2, row_end-row_begin, os[3], hausdorff1, hausdorff2);
+		}else{
+			res = MeshDist(data1, data2, row_end-row_begin, os[3], hausdorff1, hausdorff2, bound, param.stop_under_bound);
+		}
+	}
+	if(!intersect || res.intersected){
+		res.p1 += row_begin;
+	}
+	return res;
+}
+
+/*
+ * merge the result of the next rows of a split pair, the parts are merged
+ * in the order of the rows so the result is the same as the unsplit one
+ * */
+static void merge_partial(result_container &res, const result_container &part, bool intersect){
+	if(intersect){
+		// the computation stops at the first intersection found
+		if(res.intersected){
+			return;
+		}
+		if(part.intersected){
+			res = part;
+			return;
+		}
+		res.distance = min(res.distance, part.distance);
+		res.min_dist = min(res.min_dist, part.min_dist);
+	}else{
+		if(part.distance < res.distance){
+			res.distance = part.distance;
+			res.p1 = part.p1;
+			res.p2 = part.p2;
+		}
+		res.min_dist = min(res.min_dist, part.min_dist);
+		res.max_dist = min(res.max_dist, part.max_dist);
+		// the merged distance is exact once it is no larger than
+		// the lower bounds of all the bounded parts
+		res.bounded = (res.bounded || part.bounded) && res.min_dist < res.distance;
+	}
+}
+
+static void run_chunk(geometry_job *job, const geometry_chunk &chunk){
+	const geometry_param &param = *job->param;
+	if(chunk.partial >= 0){
+		job->partials[chunk.partial] = compute_pair(param, chunk.pair_begin, chunk.row_begin, chunk.row_end, job->intersect);
+		return;
+	}
+	for(uint32_t i=chunk.pair_begin;i<chunk.pair_end;i++){
+		param.results[i] = compute_pair(param, i, 0, param.offset_size[4*i+1], job->intersect);
 	}
-	return NULL;
 }
 
 bool geometry_computer::request_cpu(){
@@ -99,6 +252,9 @@ void geometry_computer::get_intersect_gpu(geometry_param &cc){
 #endif
 
 geometry_computer::~geometry_computer(){
+	stop_workers();
+	pthread_mutex_destroy(&task_lock);
+	pthread_cond_destroy(&task_cond);
 #ifdef USE_GPU
 	for(gpu_info *info:gpus){
 		clean_gpu(info);
@@ -107,45 +263,12 @@ geometry_computer::~geometry_computer(){
 #endif
 }
 void geometry_computer::get_distance_cpu(geometry_param &cc){
-
-	int each_thread = cc.pair_num/max_thread_num;
-	int thread_num = max_thread_num;
-	if(each_thread==0){
-		thread_num = cc.pair_num;
-	}
-	each_thread++;
-	pthread_t threads[thread_num];
-	geometry_param params[thread_num];
-
-	int i=0;
-	for(;i<thread_num;i++){
-		int start = each_thread*i;
-		if(start>=cc.pair_num){
-			break;
-		}
-
-		params[i] = cc;
-		params[i].pair_num = min(each_thread, (int)cc.pair_num-start);
-		params[i].offset_size = cc.offset_size+start*4;
-		params[i].data = cc.data;
-		params[i].hausdorff = cc.hausdorff;
-		params[i].id = i+1;
-		params[i].results = cc.results+start;
-		pthread_create(&threads[i], NULL, MeshDist_unit, (void *)&params[i]);
-	}
-	if(max_thread_num>1){
-		log("%d threads started to get distance", thread_num);
-	}
-	for(; i > 0; i--){
-		void *status;
-		pthread_join(threads[i-1], &status);
-	}
+	compute_cpu(cc, false);
 }
 
-
-
 void geometry_computer::get_distance(geometry_param &cc){
-	if(gpus.size()>0){
+	// the SoA packing is only consumed by the CPU kernels
+	if(gpus.size()>0 && !cc.soa && !cc.reference){
 #ifdef USE_GPU
 		get_distance_gpu(cc);
 #endif
@@ -157,49 +280,166 @@ void geometry_computer::get_distance(geometry_param &cc){
 //	}
 }
 
-void *TriInt_unit(void *params_void){
-	geometry_param *param = (geometry_param *)params_void;
-	for(int i=0;i<param->pair_num;i++){
-		param->results[i] = MeshInt(param->data+param->offset_size[4*i]*9,
-									    param->data+param->offset_size[4*i+2]*9,
-									    param->offset_size[4*i+1],
-									    param->offset_size[4*i+3],
-										param->hausdorff+param->offset_size[4*i]*2,
-										param->hausdorff+param->offset_size[4*i+2]*2);
+void geometry_computer::get_intersect_cpu(geometry_param &cc){
+	compute_cpu(cc, true);
+}
+
+void *geometry_computer::worker_unit(void *arg){
+	geometry_computer *gc = (geometry_computer *)arg;
+	while(true){
+		pthread_mutex_lock(&gc->task_lock);
+		while(gc->tasks.empty() && !gc->stopping){
+			pthread_cond_wait(&gc->task_cond, &gc->task_lock);
+		}
+		if(gc->tasks.empty()){
+			// stopping and nothing left
+			pthread_mutex_unlock(&gc->task_lock);
+			break;
+		}
+		geometry_job *job = gc->tasks.front();
+		gc->tasks.pop();
+		pthread_mutex_unlock(&gc->task_lock);
+
+		// claim the chunks of the job till all are taken
+		size_t c;
+		while((c = job->cursor.fetch_add(1)) < job->chunks.size()){
+			run_chunk(job, job->chunks[c]);
+		}
+		job->latch->count_down();
 	}
 	return NULL;
 }
 
-void geometry_computer::get_intersect_cpu(geometry_param &cc){
+// must be called with the task lock held
+void geometry_computer::start_workers(){
+	assert(workers.size()==0);
+	workers.resize(max(max_thread_num, 1));
+	for(pthread_t &t:workers){
+		pthread_create(&t, NULL, worker_unit, (void *)this);
+	}
+}
 
-	pthread_t threads[max_thread_num];
-	geometry_param params[max_thread_num];
-	int each_thread = cc.pair_num/max_thread_num+1;
-	int tnum = 0;
-	for(tnum=0;tnum<max_thread_num;tnum++){
-		int start = each_thread*tnum;
-		if(start>=cc.pair_num){
-			break;
-		}
-		params[tnum] = cc;
-		params[tnum].id = tnum+1;
-		params[tnum].pair_num = min(each_thread, (int)cc.pair_num-start);
-		params[tnum].offset_size = cc.offset_size+start*4;
-		params[tnum].data = cc.data;
-		params[tnum].hausdorff = cc.hausdorff;
-		params[tnum].results = cc.results+start;
-		pthread_create(&threads[tnum], NULL, TriInt_unit, (void *)&params[tnum]);
-	}
-	log("%d threads started", max_thread_num);
-	for(int i = 0; i < tnum; i++){
+void geometry_computer::stop_workers(){
+	pthread_mutex_lock(&task_lock);
+	stopping = true;
+	pthread_cond_broadcast(&task_cond);
+	pthread_mutex_unlock(&task_lock);
+	for(pthread_t &t:workers){
 		void *status;
-		pthread_join(threads[i], &status);
+		pthread_join(t, &status);
+	}
+	workers.clear();
+	stopping = false;
+}
+
+void geometry_computer::set_thread_num(uint32_t num){
+	// restart the workers with the new number of threads
+	stop_workers();
+	max_thread_num = num;
+	pthread_mutex_lock(&task_lock);
+	start_workers();
+	pthread_mutex_unlock(&task_lock);
+}
+
+/*
+ * the work of a pair is the number of its triangle pairs, which varies
+ * by orders of magnitude between voxels. the pairs are cut into chunks
+ * of similar work, cheap pairs are grouped and the expensive ones are
+ * split by the rows of their first voxel. the workers claim the chunks
+ * dynamically and the requester merges the split pairs at last.
+ * multiple requesters (e.g. the threads processing different tile
+ * pairs) share the workers
+ * */
+void geometry_computer::compute_cpu(geometry_param &cc, bool intersect){
+	if(cc.pair_num == 0){
+		return;
+	}
+	pthread_mutex_lock(&task_lock);
+	if(workers.size()==0){
+		start_workers();
+	}
+	const int thread_num = workers.size();
+	pthread_mutex_unlock(&task_lock);
+
+	size_t total_cost = 0;
+	for(uint32_t i=0;i<cc.pair_num;i++){
+		total_cost += max((size_t)cc.offset_size[4*i+1]*cc.offset_size[4*i+3], (size_t)1);
+	}
+	const size_t grain = max(total_cost/(thread_num*CHUNKS_PER_THREAD), (size_t)MIN_CHUNK_COST);
+
+	geometry_job job;
+	job.param = &cc;
+	job.intersect = intersect;
+	// the split pairs, and the first of their partial results
+	vector<pair<uint32_t, int>> splits;
+	geometry_chunk run;
+	size_t run_cost = 0;
+	for(uint32_t i=0;i<cc.pair_num;i++){
+		const size_t size1 = cc.offset_size[4*i+1];
+		const size_t size2 = cc.offset_size[4*i+3];
+		const size_t cost = max(size1*size2, (size_t)1);
+		// the pairs traversed with the BVHs are not split by rows
+		if(cost > grain && size1 > 1 && cc.trees == NULL){
+			if(run_cost > 0){
+				job.chunks.push_back(run);
+				run_cost = 0;
+			}
+			const size_t rows = max(grain/size2, (size_t)1);
+			splits.push_back(pair<uint32_t, int>(i, job.partials.size()));
+			for(size_t r=0;r<size1;r+=rows){
+				geometry_chunk chunk;
+				chunk.pair_begin = i;
+				chunk.pair_end = i+1;
+				chunk.row_begin = r;
+				chunk.row_end = min(r+rows, size1);
+				chunk.partial = job.partials.size();
+				job.partials.push_back(result_container());
+				job.chunks.push_back(chunk);
+			}
+			continue;
+		}
+		if(run_cost == 0){
+			run.pair_begin = i;
+		}
+		run.pair_end = i+1;
+		run_cost += cost;
+		if(run_cost >= grain){
+			job.chunks.push_back(run);
+			run_cost = 0;
+		}
+	}
+	if(run_cost > 0){
+		job.chunks.push_back(run);
+	}
+
+	const int task_num = min((size_t)thread_num, job.chunks.size());
+	task_latch latch(task_num);
+	job.latch = &latch;
+	pthread_mutex_lock(&task_lock);
+	for(int i=0;i<task_num;i++){
+		tasks.push(&job);
+	}
+	pthread_cond_broadcast(&task_cond);
+	pthread_mutex_unlock(&task_lock);
+	if(thread_num>1){
+		log("%ld chunks with %ld triangle pairs queued to %d threads to %s", job.chunks.size(), total_cost, task_num, intersect?"check intersect":"get distance");
+	}
+	latch.wait();
+
+	for(size_t s=0;s<splits.size();s++){
+		const int first = splits[s].second;
+		const int last = s+1<splits.size() ? splits[s+1].second : job.partials.size();
+		result_container &res = cc.results[splits[s].first];
+		res = job.partials[first];
+		for(int p=first+1;p<last;p++){
+			merge_partial(res, job.partials[p], intersect);
+		}
 	}
 }
 
 void geometry_computer::get_intersect(geometry_param &cc){
 
-	if(gpus.size()>0){
+	if(gpus.size()>0 && !cc.soa && !cc.reference){
 #ifdef USE_GPU
 		get_intersect_gpu(cc);
 #endif
@@ -70,13 +70,18 @@ public:
 
 	vector<candidate_entry *> mbb_knn(Tile *tile1, Tile *tile2, query_context &ctx);
 	vector<candidate_entry *> mbb_within(Tile *tile1, Tile *tile2, query_context &ctx);
-	vector<candidate_entry *> mbb_intersect(Tile *tile1, Tile *tile2);
+	vector<candidate_entry *> mbb_intersect(Tile *tile1, Tile *tile2, query_context &ctx);
 
 	range update_voxel_pair_list(vector<voxel_pair> &voxel_pairs, double minmaxdist);
+	// the voxel pairs between an object and the objects of tile2 from the voxel index
+	void index_voxel_pairs(HiMesh_Wrapper *wrapper1, Tile *tile2, STRTree *index, float threshold, vector<candidate_info> &cis);
 
 	void decode_data(vector<candidate_entry *> &candidates, query_context &ctx);
 
 	geometry_param packing_data(vector<candidate_entry *> &candidates, query_context &ctx);
+	geometry_param packing_references(vector<candidate_entry *> &candidates, query_context &ctx, geometry_param &gp);
+	void set_distance_bounds(vector<candidate_entry *> &candidates, query_context &ctx, geometry_param &gp);
+	void build_aabb_trees(vector<candidate_entry *> &candidates, query_context &ctx, bool distance);
 	void calculate_distance(vector<candidate_entry *> &candidates, query_context &ctx);
 	void check_intersection(vector<candidate_entry *> &candidates, query_context &ctx);
 
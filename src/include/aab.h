@@ -57,6 +57,8 @@ public:
 	}
 }range;
 
+class aab_soa;
+
 class aab{
 public:
 	float low[3];
@@ -90,6 +92,9 @@ public:
 	float diagonal_length();
 	float volume();
 	range distance(const aab &b);
+	// the distances to boxes [first, first+num) in the batch, same as
+	// calling distance() for each of them
+	void distance(const aab_soa &boxes, size_t first, size_t num, range *ret);
 
 	inline float length(){return high[0] - low[0];};
 	inline float width(){return high[1] - low[1];};
@@ -104,6 +109,77 @@ public:
 	uint32_t size = 1;
 };
 
+/*
+ * a batch of boxes for computing the distances from one box to many of them
+ * with SIMD. the boxes are stored in blocks of AAB_SOA_BLOCK, each block has
+ * the low[0], low[1], low[2], high[0], high[1], high[2] of its boxes in turn,
+ * so a block is one allocation with one SIMD load per coordinate
+ * */
+#define AAB_SOA_BLOCK 8
+
+class aab_soa{
+	vector<float> data;
+	size_t num = 0;
+public:
+	void clear();
+	void push_back(const aab &b);
+	inline size_t size() const{
+		return num;
+	}
+	// coordinate k (low[0..2] then high[0..2]) of box i
+	inline float get(int k, size_t i) const{
+		return data[(i/AAB_SOA_BLOCK)*6*AAB_SOA_BLOCK + k*AAB_SOA_BLOCK + i%AAB_SOA_BLOCK];
+	}
+	// the block starting with box i
+	inline const float *block(size_t i) const{
+		assert(i%AAB_SOA_BLOCK == 0);
+		return data.data() + (i/AAB_SOA_BLOCK)*6*AAB_SOA_BLOCK;
+	}
+	template<class T>
+	void assign(const vector<T *> &boxes){
+		clear();
+		for(T *b:boxes){
+			push_back(*b);
+		}
+	}
+};
+
+/*
+ * a flat bounding volume hierarchy over the triangles of a voxel. the nodes
+ * are stored in depth-first order, the left child of an inner node follows
+ * it and the right child is nodes[right]. the triangles under a node are
+ * order[first, first+count), max_phdist and min_hdist are the largest proxy
+ * hausdorff and the smallest hausdorff distances of them
+ * */
+#define BVH_LEAF_SIZE 4
+
+class bvh_node{
+public:
+	float box[6];
+	float max_phdist = 0;
+	float min_hdist = 0;
+	uint32_t right = 0;
+	uint32_t first = 0;
+	uint32_t count = 0;
+	inline bool is_leaf() const{
+		return count <= BVH_LEAF_SIZE;
+	}
+};
+
+class triangle_bvh{
+public:
+	vector<bvh_node> nodes;
+	vector<uint32_t> order;
+public:
+	void build(const float *triangles, const float *hausdorff, size_t num);
+	void clear();
+	inline size_t size() const{
+		return order.size();
+	}
+private:
+	uint32_t build_node(const float *triangles, const float *hausdorff, const float *centroids, uint32_t first, uint32_t count);
+};
+
 /*
  * each voxel contains the minimum boundary box
  * of a set of edges or triangles. It is an extension of
@@ -124,6 +200,9 @@ public:
 	map<int, size_t> volume_lod;
 
 	bool owned = false;
+
+	// optional, built over the triangles once they are filled
+	triangle_bvh bvh;
 public:
 	~Voxel();
 	void clear();
@@ -132,6 +211,7 @@ public:
 	void insert(const float *t, const float *h);
 	void batch_load(const float *t, const float *h, size_t s);
 	void external_load(float *t, float *h, size_t s);
+	void build_bvh();
 	void print();
 
 	float getHausdorffDistance(int offset);
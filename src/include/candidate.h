@@ -45,6 +45,9 @@ public:
 	}
 	HiMesh_Wrapper *mesh_wrapper = NULL;
 	range distance;
+	// the upper bound of the distance derived from the triangles
+	// computed so far, the box distances are not involved
+	float bound = FLT_MAX;
 	vector<voxel_pair> voxel_pairs;
 };
 
@@ -4,9 +4,12 @@
 #include <math.h>
 #include <stdio.h>
 #include <iostream>
+#include <queue>
+#include <atomic>
 #include <float.h>
 #include "mygpu.h"
 #include "util.h"
+#include "aab.h"
 #include "pthread.h"
 using namespace std;
 
@@ -108,6 +111,9 @@ public:
 	float distance; // for normal distance
 	float min_dist; // for distance range
 	float max_dist;
+	// some triangle pairs are skipped by the bound, distance is then
+	// only an upper bound and min_dist the lower bound
+	bool bounded;
 	void print(){
 		cout<<"p1:\t"<<p1<<endl;
 		cout<<"p2:\t"<<p2<<endl;
@@ -115,35 +121,117 @@ public:
 		cout<<"distance:\t"<<distance<<endl;
 		cout<<"min_dist:\t"<<min_dist<<endl;
 		cout<<"max_dist:\t"<<max_dist<<endl;
+		cout<<"bounded:\t"<<bounded<<endl;
 	}
 } ;
 
+// the widest batch of the TriDist kernel and the alignment (in bytes)
+// of the rows in the SoA packing
+#define TRIDIST_MAX_WIDTH 16
+#define SOA_ALIGNMENT 64
+#define HUGE_PAGE_SIZE (2UL<<20)
+
+/*
+ * the buffers for packing the data of the geometric computation. each
+ * thread keeps its own buffers, which only grow and are reused across LODs
+ * and tile pairs instead of being allocated for every request. a buffer is
+ * aligned to SOA_ALIGNMENT, or mapped and advised to be backed by huge
+ * pages. the content is not kept when a buffer grows
+ * */
+enum buffer_slot{
+	BUFFER_DATA = 0,
+	BUFFER_HAUSDORFF,
+	BUFFER_OFFSET_SIZE,
+	BUFFER_BOUNDS,
+	BUFFER_TREES,
+	BUFFER_VOXEL_TRIANGLES,
+	BUFFER_VOXEL_HAUSDORFF,
+	BUFFER_RESULTS,
+	BUFFER_SLOT_NUM
+};
+
+class buffer_arena{
+	void *buffers[BUFFER_SLOT_NUM];
+	size_t capacity[BUFFER_SLOT_NUM];
+	bool hugepage[BUFFER_SLOT_NUM];
+	void release(int slot);
+public:
+	buffer_arena();
+	~buffer_arena();
+	void *get(int slot, size_t bytes, bool use_hugepage);
+	template<class T> T *get(int slot, size_t num, bool use_hugepage){
+		return (T *)get(slot, num*sizeof(T), use_hugepage);
+	}
+	// the buffers of the calling thread
+	static buffer_arena &local();
+};
+
 class geometry_param{
 public:
 	int id = 0;
 	uint32_t pair_num = 0;
 	uint32_t element_num = 0;
 	size_t element_pair_num = 0;
+	/*
+	 * in the default AoS packing, triangle t is stored as data[9*t, 9*t+9)
+	 * and its hausdorff distances as hausdorff[2*t, 2*t+2). in the SoA
+	 * packing, coordinate k of triangle t is stored at data[k*stride+t] and
+	 * the hausdorff distances at hausdorff[t] and hausdorff[stride+t], the
+	 * triangles of each voxel start at a multiple of TRIDIST_MAX_WIDTH
+	 * */
+	bool soa = false;
+	size_t stride = 0;
 	float *data = NULL;
 	float *hausdorff = NULL;
+	/*
+	 * in the reference packing nothing is copied, the offsets in offset_size
+	 * index the voxels, whose triangles and hausdorff distances are read in
+	 * place (AoS) from voxel_triangles[v] and voxel_hausdorff[v]
+	 * */
+	bool reference = false;
+	const float **voxel_triangles = NULL;
+	const float **voxel_hausdorff = NULL;
 	// the offset and size of the computing pairs
 	uint32_t *offset_size = NULL;
+	// optional, the distance bound of each pair for the bounded MeshDist
+	float *bounds = NULL;
+	bool stop_under_bound = false;
+	// optional, the BVHs over the triangles of the two voxels of each pair
+	const triangle_bvh **trees = NULL;
 	result_container *results = NULL;
+	// back the buffers with huge pages
+	bool hugepage = false;
+	/*
+	 * the buffers are borrowed from the arena of the calling thread, they are
+	 * valid until the thread packs the next request
+	 * */
+	template<class T> T *borrow(int slot, size_t num){
+		return buffer_arena::local().get<T>(slot, num, hugepage);
+	}
 	void allocate_buffer(){
-		data = new float[9*element_num];
-		hausdorff = new float[2*element_num];
-		offset_size = new uint32_t[4*pair_num];
+		if(reference){
+			voxel_triangles = borrow<const float *>(BUFFER_VOXEL_TRIANGLES, element_num);
+			voxel_hausdorff = borrow<const float *>(BUFFER_VOXEL_HAUSDORFF, element_num);
+		}else{
+			if(soa){
+				assert(element_num%TRIDIST_MAX_WIDTH == 0);
+				stride = element_num;
+			}
+			// aligned to SOA_ALIGNMENT as required
+			data = borrow<float>(BUFFER_DATA, 9*element_num);
+			hausdorff = borrow<float>(BUFFER_HAUSDORFF, 2*element_num);
+		}
+		offset_size = borrow<uint32_t>(BUFFER_OFFSET_SIZE, 4*pair_num);
 	}
 	void clear_buffer(){
-		if(data){
-			delete []data;
-		}
-		if(hausdorff){
-			delete []hausdorff;
-		}
-		if(offset_size){
-			delete []offset_size;
-		}
+		// the buffers stay with the arena for the next request
+		data = NULL;
+		hausdorff = NULL;
+		voxel_triangles = NULL;
+		voxel_hausdorff = NULL;
+		offset_size = NULL;
+		bounds = NULL;
+		trees = NULL;
 	}
 };
 
@@ -160,17 +248,117 @@ bool PointInTriangleCylinder(const float *point, const float *triangle);
 void project_points_to_triangle_plane(const float *point, const float *triangle, float projected_point[3]);
 float PointTriangleDist(const float *point, const float *triangle);
 float TriDist(const float *S, const float *T);
-result_container MeshDist(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1 = NULL, const float *hausdorff2 = NULL);
+float TriDist_finish(const float *S, const float *T, float mindd_seg, bool shown_disjoint);
+// the batched TriDist kernel, evaluates one triangle against a block of triangles
+// stored as T[k*stride+l], blocks are padded to TRIDIST_MAX_WIDTH
+int TriDist_batch_width();
+void TriDist_enable_simd(bool enable);
+void TriDist_transpose(const float *T, size_t num, size_t stride, float *T_soa);
+void TriDist_batch(const float *S, const float *T, size_t stride, size_t num, float *dist);
+// the triangle pairs farther than the bound are skipped, see MeshDist_rows()
+result_container MeshDist(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1 = NULL, const float *hausdorff2 = NULL,
+		float bound = FLT_MAX, bool stop_under_bound = false);
+// for the triangles and hausdorff distances in SoA packing, see geometry_param
+result_container MeshDist(const float *data1, const float *data2, size_t size1, size_t size2, size_t stride, const float *hausdorff1, const float *hausdorff2,
+		float bound = FLT_MAX, bool stop_under_bound = false);
+// traverse the BVHs of the two voxels instead of evaluating all the triangle pairs,
+// the triangles are in SoA packing with the given stride, or AoS packing with stride 0
+result_container MeshDist_bvh(const float *data1, const float *data2, size_t stride, const triangle_bvh *tree1, const triangle_bvh *tree2,
+		const float *hausdorff1, const float *hausdorff2, float bound = FLT_MAX, bool stop_under_bound = false);
 void MeshDist_batch_gpu(gpu_info *gpu, const float *data, const uint32_t *offset_size, const float * hausdorff, result_container *result, const uint32_t pair_num, const uint32_t element_num);
 
 bool TriInt(const float *S, const float *T);
 result_container MeshInt(const float *data1, const float *data2, size_t size1, size_t size2, const float *hausdorff1 = NULL, const float *hausdorff2 = NULL);
+result_container MeshInt(const float *data1, const float *data2, size_t size1, size_t size2, size_t stride, const float *hausdorff1, const float *hausdorff2);
+result_container MeshInt_bvh(const float *data1, const float *data2, size_t stride, const triangle_bvh *tree1, const triangle_bvh *tree2,
+		const float *hausdorff1, const float *hausdorff2);
 void TriInt_batch_gpu(gpu_info *gpu, const float *data, const uint32_t *offset_size, const float *hausdorff, result_container *result, const uint32_t batch_num, const uint32_t triangle_num);
 
+/*
+ * counts down the unfinished tasks of one computation request,
+ * the requester waits until all of them are done
+ * */
+class task_latch{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int count;
+public:
+	task_latch(int c){
+		count = c;
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+	~task_latch(){
+		pthread_mutex_destroy(&lock);
+		pthread_cond_destroy(&cond);
+	}
+	void count_down(){
+		pthread_mutex_lock(&lock);
+		assert(count>0);
+		if(--count == 0){
+			pthread_cond_broadcast(&cond);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	void wait(){
+		pthread_mutex_lock(&lock);
+		while(count > 0){
+			pthread_cond_wait(&cond, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+};
+
+/*
+ * a chunk of the work of one request, either the whole pairs in
+ * [pair_begin, pair_end), or the rows [row_begin, row_end) of the
+ * first voxel of one large pair, whose result goes to partials[partial]
+ * */
+class geometry_chunk{
+public:
+	uint32_t pair_begin = 0;
+	uint32_t pair_end = 0;
+	uint32_t row_begin = 0;
+	uint32_t row_end = 0;
+	int partial = -1;
+};
+
+// one request to the CPU workers, the chunks are claimed through the cursor
+class geometry_job{
+public:
+	geometry_param *param = NULL;
+	bool intersect = false;
+	vector<geometry_chunk> chunks;
+	vector<result_container> partials;
+	std::atomic<size_t> cursor;
+	task_latch *latch = NULL;
+	geometry_job(){
+		cursor = 0;
+	}
+};
+
+// the CPU requests are cut into about CHUNKS_PER_THREAD chunks per worker,
+// and chunks with fewer than MIN_CHUNK_COST triangle pairs are not worth it
+#define CHUNKS_PER_THREAD 8
+#define MIN_CHUNK_COST 4096
+
 class geometry_computer{
 	pthread_mutex_t gpu_lock;
 	pthread_mutex_t cpu_lock;
 	int max_thread_num = tdbase::get_num_threads();
+
+	// the long-lived workers for the CPU computation, they are
+	// started with the first request or by set_thread_num()
+	vector<pthread_t> workers;
+	queue<geometry_job *> tasks;
+	pthread_mutex_t task_lock;
+	pthread_cond_t task_cond;
+	bool stopping = false;
+	static void *worker_unit(void *arg);
+	void start_workers();
+	void stop_workers();
+	void compute_cpu(geometry_param &cc, bool intersect);
+
 	bool cpu_busy = false;
 	bool gpu_busy = false;
 	bool request_cpu();
@@ -186,6 +374,8 @@ public:
 	geometry_computer(){
 		pthread_mutex_init(&cpu_lock, NULL);
 		pthread_mutex_init(&gpu_lock, NULL);
+		pthread_mutex_init(&task_lock, NULL);
+		pthread_cond_init(&task_cond, NULL);
 	}
 
 	bool init_gpus();
@@ -196,9 +386,7 @@ public:
 	void get_intersect_gpu(geometry_param &param);
 	void get_intersect_cpu(geometry_param &param);
 	void get_intersect(geometry_param &param);
-	void set_thread_num(uint32_t num){
-		max_thread_num = num;
-	}
+	void set_thread_num(uint32_t num);
 };
 
 
@@ -32,6 +32,7 @@
 #include <utility>
 #include <unordered_map>
 #include <map>
+#include <atomic>
 
 #include <CGAL/Kernel/interface_macros.h>
 #include <CGAL/Simple_cartesian.h>
@@ -75,6 +76,7 @@
 #include "util.h"
 #include "geometry.h"
 #include "query_context.h"
+#include "rans.h"
 
 
 namespace tdbase{
@@ -91,6 +93,21 @@ const int DECOMPRESSION_MODE_ID = 1;
 
 #define PPMC_RANDOM_CONSTANT 0315
 
+/*
+ * since version 2, the mesh stream starts with a codec header
+ * | magic (4B) | version (1B) | flags (1B) | quantization bits (1B) | quantization exponent (1B) |
+ * the magic is a NaN pattern, which can never be the first coordinate
+ * of the bounding box that the legacy streams start with.
+ * */
+#define HIMESH_CODEC_MAGIC 0x7FC0DB01
+#define HIMESH_CODEC_VERSION 2
+// the codec flags tell how the Hausdorff distances of the faces are stored.
+// streams with neither flag set (legacy ones) store both the byte codes and the floats
+#define HIMESH_FLAG_HAUSDORFF_BYTE 0x01
+#define HIMESH_FLAG_HAUSDORFF_FLOAT 0x02
+// at most 20 bits per coordinate, so the quantized grid is always exact in float
+#define HIMESH_MAX_QUANTIZATION_BITS 20
+
 const int NUM_FACET_PER_VOXEL = 100;
 
 using namespace std;
@@ -163,14 +180,40 @@ private:
     std::deque<uint32_t *> *p_faceDeque;
 };
 
+/*
+ * the states of the vertices, halfedges and faces only live within one
+ * compression or decompression operation. instead of clearing them on
+ * every element before each operation, the operation takes a new epoch
+ * and the states stamped with an older epoch are treated as reset.
+ * the getters compare the stamp, the setters reset the stale states first.
+ * */
+inline thread_local uint64_t current_epoch = 0;
+inline std::atomic<uint64_t> epoch_counter(0);
+
+// start a new epoch for the operation running on this thread, O(1)
+inline void start_new_epoch(){
+	current_epoch = ++epoch_counter;
+}
+
 // My vertex type has a isConquered flag
 template <class Refs>
 class MyVertex : public CGAL::HalfedgeDS_vertex_base<Refs,CGAL::Tag_true, Point>
 {
-    enum Flag {Unconquered=0, Conquered=1};
+    enum Flag : uint8_t {Unconquered=0, Conquered=1};
 
 	Flag flag = Unconquered;
+	uint64_t epoch = 0;
 	unsigned int id = 0;
+	// the voxel the facets led by this vertex fall into
+	int voxel_id = -1;
+
+	inline void validate()
+	{
+	  if(epoch != current_epoch){
+		  flag = Unconquered;
+		  epoch = current_epoch;
+	  }
+	}
   public:
     MyVertex(): CGAL::HalfedgeDS_vertex_base<Refs,CGAL::Tag_true, Point>(){}
 	MyVertex(const Point &p): CGAL::HalfedgeDS_vertex_base<Refs,CGAL::Tag_true, Point>(p){}
@@ -178,15 +221,17 @@ class MyVertex : public CGAL::HalfedgeDS_vertex_base<Refs,CGAL::Tag_true, Point>
 	inline void resetState()
 	{
 	  flag=Unconquered;
+	  epoch = current_epoch;
 	}
 
 	inline bool isConquered() const
 	{
-	  return flag==Conquered;
+	  return epoch==current_epoch && flag==Conquered;
 	}
 
 	inline void setConquered()
 	{
+	  validate();
 	  flag=Conquered;
 	}
 
@@ -199,18 +244,39 @@ class MyVertex : public CGAL::HalfedgeDS_vertex_base<Refs,CGAL::Tag_true, Point>
 	{
 		id = nId;
 	}
+
+	inline int getVoxelId() const
+	{
+		return voxel_id;
+	}
+
+	inline void setVoxelId(int vid)
+	{
+		voxel_id = vid;
+	}
 };
 
 template <class Refs>
 class MyHalfedge : public CGAL::HalfedgeDS_halfedge_base<Refs>
 {
-    enum Flag {NotYetInQueue=0, InQueue=1, NoLongerInQueue=2};
-    enum Flag2 {Original, Added, New};
-    enum ProcessedFlag {NotProcessed, Processed};
+    enum Flag : uint8_t {NotYetInQueue=0, InQueue=1, NoLongerInQueue=2};
+    enum Flag2 : uint8_t {Original, Added, New};
+    enum ProcessedFlag : uint8_t {NotProcessed, Processed};
 
 	Flag flag = NotYetInQueue;
 	Flag2 flag2 = Original;
 	ProcessedFlag processedFlag = NotProcessed;
+	uint64_t epoch = 0;
+
+	inline void validate()
+	{
+		if(epoch != current_epoch){
+			flag = NotYetInQueue;
+			flag2 = Original;
+			processedFlag = NotProcessed;
+			epoch = current_epoch;
+		}
+	}
 public:
     MyHalfedge(){}
 
@@ -219,17 +285,20 @@ public:
 		flag = NotYetInQueue;
 		flag2 = Original;
 		processedFlag = NotProcessed;
+		epoch = current_epoch;
 	}
 
         /* Flag 1 */
 
 	inline void setInQueue()
 	{
+	  validate();
 	  flag=InQueue;
 	}
 
 	inline void removeFromQueue()
 	{
+	  validate();
 	  assert(flag==InQueue);
 	  flag=NoLongerInQueue;
 	}
@@ -238,46 +307,50 @@ public:
 
 	inline void resetProcessedFlag()
 	{
+	  validate();
 	  processedFlag = NotProcessed;
 	}
 
 	inline void setProcessed()
 	{
+		validate();
 		processedFlag = Processed;
 	}
 
 	inline bool isProcessed() const
 	{
-		return (processedFlag == Processed);
+		return epoch==current_epoch && processedFlag == Processed;
 	}
 
 	/* Flag 2 */
 
 	inline void setAdded()
 	{
+	  validate();
 	  assert(flag2 == Original);
 	  flag2=Added;
 	}
 
 	inline void setNew()
 	{
+		validate();
 		assert(flag2 == Original);
 		flag2 = New;
 	}
 
 	inline bool isAdded() const
 	{
-	  return flag2==Added;
+	  return epoch==current_epoch && flag2==Added;
 	}
 
 	inline bool isOriginal() const
 	{
-	  return flag2==Original;
+	  return epoch!=current_epoch || flag2==Original;
 	}
 
 	inline bool isNew() const
 	{
-	  return flag2 == New;
+	  return epoch==current_epoch && flag2 == New;
 	}
 };
 
@@ -309,11 +382,21 @@ class MyTriangle;
 template <class Refs>
 class MyFace : public CGAL::HalfedgeDS_face_base<Refs>
 {
-    enum Flag {Unknown=0, Splittable=1, Unsplittable=2};
-    enum ProcessedFlag {NotProcessed, Processed};
+    enum Flag : uint8_t {Unknown=0, Splittable=1, Unsplittable=2};
+    enum ProcessedFlag : uint8_t {NotProcessed, Processed};
 
 	Flag flag = Unknown;
 	ProcessedFlag processedFlag = NotProcessed;
+	uint64_t epoch = 0;
+
+	inline void validate()
+	{
+		if(epoch != current_epoch){
+			flag = Unknown;
+			processedFlag = NotProcessed;
+			epoch = current_epoch;
+		}
+	}
 
 	Point removedVertexPos;
 	float proxy_hausdorff_distance = 0.0;
@@ -325,48 +408,53 @@ public:
 	{
           flag = Unknown;
           processedFlag = NotProcessed;
+          epoch = current_epoch;
 	}
 
 	inline void resetProcessedFlag()
 	{
+	  validate();
 	  processedFlag = NotProcessed;
 	}
 
 	inline bool isConquered() const
 	{
-	  return (flag==Splittable ||flag==Unsplittable) ;
+	  return epoch==current_epoch && (flag==Splittable ||flag==Unsplittable) ;
 	}
 
 	inline bool isSplittable() const
 	{
-	  return (flag==Splittable) ;
+	  return epoch==current_epoch && (flag==Splittable) ;
 	}
 
 	inline bool isUnsplittable() const
 	{
-	  return (flag==Unsplittable) ;
+	  return epoch==current_epoch && (flag==Unsplittable) ;
 	}
 
 	inline void setSplittable()
 	{
+	  validate();
 	  assert(flag == Unknown);
 	  flag=Splittable;
 	}
 
 	inline void setUnsplittable()
 	{
+	  validate();
 	  assert(flag == Unknown);
 	  flag=Unsplittable;
 	}
 
 	inline void setProcessedFlag()
 	{
+		validate();
 		processedFlag = Processed;
 	}
 
 	inline bool isProcessed() const
 	{
-		return (processedFlag == Processed);
+		return epoch==current_epoch && (processedFlag == Processed);
 	}
 
 	inline Point getRemovedVertexPos() const
@@ -470,6 +558,8 @@ class HiMesh: public CGAL::Polyhedron_3< MyKernel, MyItems >
 	Vertex_handle vh_departureConquest[2];
 	// Geometry symbol list.
 	std::deque<std::deque<Point> > geometrySym;
+	// the quantized residuals of the removed vertices to the barycenter prediction
+	std::deque<std::deque<int32_t> > geometryResidualSym;
 
 	std::deque<std::deque<unsigned char>> hausdorfSym;
 	std::deque<std::deque<unsigned char>> proxyhausdorfSym;
@@ -484,10 +574,24 @@ class HiMesh: public CGAL::Polyhedron_3< MyKernel, MyItems >
 	// The compressed data;
 	char *p_data;
 	size_t dataOffset = 0; // the offset to read and write.
+	unsigned i_bitOffset = 0; // the offset of the next bit in the current byte
+
+	// codec related, see the header format above
+	uint8_t codec_version = HIMESH_CODEC_VERSION;
+	uint8_t codec_flags = 0;
+	// 0 for storing the coordinates losslessly
+	uint8_t quantization_bits = 0;
+	int8_t quantization_exp = 0;
+	float quantization_low[3] = {0, 0, 0};
+	float quantization_step = 1.0;
+	// the shared entropy model of the quantized geometry
+	rans_model *geometry_model = NULL;
 
 	aab mbb; // the bounding box
+	// kept until the mesh is decoded to the next LOD
 	TriangleTree *triangle_tree = NULL;
 	list<Triangle> aabb_triangles;
+	list<Segment> aabb_segments;
 
 	vector<MyTriangle *> original_facets;
 
@@ -503,11 +607,18 @@ class HiMesh: public CGAL::Polyhedron_3< MyKernel, MyItems >
 	// the triangles each point associated
 	map<Point, vector<MyTriangle *>> VFmap;
 
+	// the voxels the vertices are assigned to
+	const void *assigned_voxels = NULL;
+
 public:
 	// Hausdorff calculation and storage related
 	static uint32_t sampling_rate; // equals the number of points sampled for each triangle
 	static Hausdorff_Computing_Type calculate_method;
 	static bool use_byte_coding;
+	// number of bits for quantizing the coordinates when compressing, 0 for lossless
+	static uint32_t quantization_bits_setting;
+	// how the Hausdorff distances are stored when compressing, combination of the HIMESH_FLAG_HAUSDORFF_* flags
+	static uint8_t hausdorff_storage_setting;
 
 public:
 
@@ -576,6 +687,23 @@ public:
 	void writeChar(unsigned char ch);
 	void writePoint(Point &p);
 	Point readPoint();
+	void writeVarint(uint32_t v);
+	uint32_t readVarint();
+	void writeBit(unsigned char bit);
+	unsigned char readBit();
+	void alignBits();
+
+	// geometry quantization and prediction
+	void quantize();
+	void quantize(const Point &p, int32_t q[3]) const;
+	Point dequantize(const int32_t q[3]) const;
+	void predict(Face_handle f, int32_t pred[3]) const;
+	inline bool is_quantized() const{ return quantization_bits > 0;}
+	inline uint8_t get_codec_version() const{ return codec_version;}
+	inline uint8_t get_hausdorff_storage() const{
+		uint8_t storage = codec_flags & (HIMESH_FLAG_HAUSDORFF_BYTE|HIMESH_FLAG_HAUSDORFF_FLOAT);
+		return storage == 0 ? (HIMESH_FLAG_HAUSDORFF_BYTE|HIMESH_FLAG_HAUSDORFF_FLOAT) : storage;
+	}
 
 	void encodeBaseMesh();
 	void decodeBaseMesh();
@@ -617,6 +745,7 @@ public:
 	 *
 	 * */
 	TriangleTree *get_aabb_tree_triangle();
+	const list<Segment> &get_aabb_segments();
 	void clear_aabb_tree();
 
 	float distance(HiMesh *target);
@@ -760,6 +889,10 @@ class HiMesh_Wrapper{
 	map<int, HiMesh *> meshes;
 
 	HiMesh *mesh = NULL;
+	// the compressed mesh is decoded only when it is needed
+	void load_mesh();
+	// decode the mesh forward to cur_lod, with the lock held
+	void decode_mesh();
 
 public:
 	Decoding_Type type;
@@ -769,6 +902,8 @@ public:
 	size_t id = -1;
 	weighted_aab box;
 	vector<Voxel *> voxels;
+	// the boxes of the voxels, for the batched distances
+	aab_soa voxel_boxes;
 
 	// used for retrieving compressed data from disk
 	char *data_buffer = NULL;
@@ -780,6 +915,10 @@ public:
 	pthread_mutex_t lock;
 	vector<HiMesh_Wrapper *> results;
 	int cur_lod = -1;
+	// the LOD the compressed mesh is decoded to
+	int mesh_lod = -1;
+	// identify the tile this object belongs to, for caching
+	size_t tile_key = 0;
 
 public:
 	HiMesh_Wrapper(map<int, HiMesh *> &meshes);
@@ -790,6 +929,13 @@ public:
 
 	HiMesh *get_mesh(){
 		if(type == COMPRESSED){
+			pthread_mutex_lock(&lock);
+			if(mesh == NULL){
+				load_mesh();
+			}
+			// the mesh is decoded forward in decode_to()
+			assert(mesh_lod >= cur_lod);
+			pthread_mutex_unlock(&lock);
 			return mesh;
 		}else if(type == MULTIMESH){
 			assert(meshes.find(cur_lod)!=meshes.end());
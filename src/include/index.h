@@ -29,10 +29,28 @@ using namespace std;
 namespace tdbase{
 
 
+/*
+ * the interface of the indexes over the objects of a tile
+ * */
+class ObjectIndex{
+public:
+	virtual ~ObjectIndex(){}
+	virtual void query_knn(weighted_aab *box, vector<pair<int, range>> &results, float &max_maxdist, const int k=1) = 0;
+	virtual void query_within(weighted_aab *box, vector<pair<int, range>> &results, const float min_farthest) = 0;
+	virtual void query_intersect(weighted_aab *box, vector<int> &results) = 0;
+};
+
+/*
+ * insert an object into the candidate list of a kNN query, which is sorted
+ * by the maxdist. the objects which cannot be among the k nearest anymore
+ * are removed, return whether it goes to the first k ones
+ * */
+bool add_candidate(vector<pair<int, range>> &candidates, size_t id, range dist, int k);
+
 /*
  * OCTree
  * */
-class OctreeNode: public weighted_aab{
+class OctreeNode: public weighted_aab, public ObjectIndex{
 public:
 	long tile_size;
 	int level;
@@ -40,6 +58,8 @@ public:
 	bool canBeSplit;
 	OctreeNode* children[8];
 	vector<weighted_aab*> objectList;
+	// the boxes of the objects in objectList, for the batched distances
+	aab_soa objectBoxes;
 	bool isroot(){
 		return level==0;
 	}
@@ -52,9 +72,47 @@ public:
 	void query_within(weighted_aab *box, vector<pair<int, range>> &results, const float min_farthest);
 	void query_intersect(weighted_aab *box, vector<int> &results);
 
+	// flatten the tree into the buffer in pre-order, the objects
+	// in the leaf nodes are recorded with their ids
+	void serialize(vector<char> &buffer);
+	// restore a flattened tree, the objects are located with their ids
+	static OctreeNode *deserialize(const char *buffer, size_t &offset, vector<weighted_aab *> &objects);
 };
 OctreeNode *build_octree(std::vector<weighted_aab*> &mbbs, int num_tiles);
 
+/*
+ * the Sort-Tile-Recursive bulk-loaded R-tree. the nodes are kept in one flat
+ * array level by level from the leaves, and the root is the last one. the
+ * children of an inner node are nodes[first, first+count), the objects of a
+ * leaf node are objects[first, first+count). unlike the octree, each object
+ * is stored once, so the queries return no duplicates
+ * */
+#define STR_NODE_CAPACITY 8
+
+class STRNode{
+public:
+	aab box;
+	uint32_t first = 0;
+	uint32_t count = 0;
+	bool isLeaf = true;
+};
+
+class STRTree: public ObjectIndex{
+	vector<STRNode> nodes;
+	vector<weighted_aab *> objects;
+	// the boxes of the objects, for the batched distances
+	aab_soa objectBoxes;
+	void query_knn(uint32_t node, weighted_aab *box, vector<pair<int, range>> &results, float &min_maxdist, const int k);
+public:
+	STRTree(vector<weighted_aab *> &objs, size_t capacity = STR_NODE_CAPACITY);
+	void query_knn(weighted_aab *box, vector<pair<int, range>> &results, float &min_maxdist, const int k=1);
+	void query_within(weighted_aab *box, vector<pair<int, range>> &results, const float threshold);
+	void query_intersect(weighted_aab *box, vector<int> &results);
+	inline size_t num_nodes(){
+		return nodes.size();
+	}
+};
+
 // sorting tree
 class SPNode{
 	weighted_aab node_voxel;
@@ -16,6 +16,7 @@
 
 #include "util.h"
 #include "geometry.h"
+#include "../storage/cache.h"
 
 using namespace std;
 
@@ -56,6 +57,14 @@ public:
 	int verbose = 0;
 	bool counter_clock = false;
 	bool disable_byte_encoding = false;
+	bool use_mmap = false;
+	bool use_bvh = false;
+	bool use_voxel_index = false;
+	bool use_hugepage = false;
+	std::string packing = "aos"; // layout of the triangles handed to the geometry computer
+	std::string index = "octree"; // index over the objects of the tiles
+	size_t cache_size = 0; // in MB, 0 for disabling the cache of decoded LODs
+	mesh_cache *cache = NULL;
 
 	uint32_t cur_lod = 0;
 	Tile *tile1 = NULL;
@@ -115,6 +124,9 @@ public:
 		cerr<<"decode:\t"<<decode_time<<endl;
 		cerr<<"packing:\t"<<packing_time<<endl;
 		fprintf(stderr, "#objects:\t%ld\n results:%ld(\t%.3f)\n", obj_count, result_count, 1.0*result_count/obj_count);
+		if(cache){
+			cache->print();
+		}
 
 		fprintf(stderr, "%f\t%f\t%f\t%f\t%f\t%f\t%f\n",
 				t*index_time/overall_time,
@@ -140,6 +152,10 @@ static query_context parse_args(int argc, char **argv){
 		("ppvp,p", "enable the ppvp mode, for simulator and join query")
 		("counter_clock,c", "is the faces recorded clock-wise or counterclock-wise")
 		("disable_byte_encoding", "using the raw hausdorff instead of the byte encoded ones")
+		("mmap", "map the tile files into memory instead of reading them into buffers")
+		("hugepage", "back the buffers for the geometric computation with huge pages")
+		("bvh", "build a BVH over the triangles of each voxel and compare the voxel pairs by traversing them")
+		("voxel_index", "generate the voxel pairs by querying an index over the voxels of tile 2")
 
 		// for data
 		("tile1", po::value<string>(&ctx.tile1_path), "path to tile 1")
@@ -158,6 +174,9 @@ static query_context parse_args(int argc, char **argv){
 		// execution setup
 		("cn", po::value<int>(&ctx.num_compute_thread), "number of threads for geometric computation for each tile")
 		("threads,n", po::value<int>(&ctx.num_thread), "number of threads for processing tiles")
+		("packing", po::value<string>(&ctx.packing), "layout of the packed triangles for the CPU kernels, aos(default)|soa|ref (read the voxels in place)")
+		("index", po::value<string>(&ctx.index), "index over the objects of the tiles, octree(default)|str")
+		("cache_size", po::value<size_t>(&ctx.cache_size), "size (MB) of the cache for the decoded LODs, 0 for no cache(default), not supported with --aabb")
 		("verbose,v", po::value<int>(&ctx.verbose), "verbose level")		
 		("print_result", "print result to standard out")
 		;
@@ -184,6 +203,18 @@ static query_context parse_args(int argc, char **argv){
 	if(vm.count("ppvp")){
 		ctx.ppvp = true;
 	}
+	if(vm.count("mmap")){
+		ctx.use_mmap = true;
+	}
+	if(vm.count("bvh")){
+		ctx.use_bvh = true;
+	}
+	if(vm.count("voxel_index")){
+		ctx.use_voxel_index = true;
+	}
+	if(vm.count("hugepage")){
+		ctx.use_hugepage = true;
+	}
 	if (vm.count("print_result")) {
 		ctx.print_result = true;
 	}
@@ -193,6 +224,19 @@ static query_context parse_args(int argc, char **argv){
 		cout <<"error query type: "<< ctx.query_type <<endl;
 		exit(0);
 	}
+	if(ctx.packing!="aos"&&ctx.packing!="soa"&&ctx.packing!="ref"){
+		cout <<"error packing: "<< ctx.packing <<endl;
+		exit(0);
+	}
+	if(ctx.index!="octree"&&ctx.index!="str"){
+		cout <<"error index: "<< ctx.index <<endl;
+		exit(0);
+	}
+	// the AABB trees are built from the meshes, the cached voxels are never read
+	if(ctx.use_aabb&&ctx.cache_size>0){
+		cout <<"the cache of decoded LODs is not supported with --aabb"<<endl;
+		exit(0);
+	}
 	if(vm.count("lod")){
 		for(string l:vm["lod"].as<std::vector<std::string>>()){
 			ctx.lods.push_back(atoi(l.c_str()));
@@ -0,0 +1,218 @@
+/*
+ * rans.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: teng
+ *
+ *  a static order-0 range Asymmetric Numeral System (rANS) coder
+ *  over bytes. One model is built for all the symbols of a mesh
+ *  and shared by the blocks coded for each decimation step, so that
+ *  every block stays independently decodable and the progressive
+ *  decoder can still stop at any LOD.
+ */
+
+#ifndef TDBASE_RANS_H_
+#define TDBASE_RANS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+
+using namespace std;
+
+namespace tdbase{
+
+#define RANS_SCALE_BITS 12
+#define RANS_SCALE (1u<<RANS_SCALE_BITS)
+// lower bound of the normalized state interval
+#define RANS_L (1u<<23)
+
+class rans_model{
+public:
+	uint16_t freq[256];
+	uint16_t cum[257];
+	// symbol of each slot in [0, RANS_SCALE), for decoding
+	uint8_t slot[RANS_SCALE];
+
+	rans_model(){
+		memset(freq, 0, sizeof(freq));
+		memset(cum, 0, sizeof(cum));
+	}
+
+	// normalize the symbol counts to frequencies summing up to RANS_SCALE,
+	// every present symbol keeps a frequency of at least one
+	void build(const uint64_t *counts){
+		uint64_t total = 0;
+		for(int i=0;i<256;i++){
+			total += counts[i];
+		}
+		uint32_t sum = 0;
+		for(int i=0;i<256;i++){
+			if(counts[i]==0){
+				freq[i] = 0;
+				continue;
+			}
+			uint64_t f = counts[i]*RANS_SCALE/total;
+			freq[i] = f==0?1:f;
+			sum += freq[i];
+		}
+		if(total==0){
+			// keep the model valid for empty inputs
+			freq[0] = RANS_SCALE;
+			sum = RANS_SCALE;
+		}
+		// hand the rounding slack to (or take it from) the largest symbols
+		while(sum != RANS_SCALE){
+			int largest = 0;
+			for(int i=1;i<256;i++){
+				if(freq[i]>freq[largest]){
+					largest = i;
+				}
+			}
+			if(sum < RANS_SCALE){
+				freq[largest] += RANS_SCALE - sum;
+				sum = RANS_SCALE;
+			}else{
+				uint32_t take = min((uint32_t)(freq[largest]-1), sum - RANS_SCALE);
+				assert(take>0);
+				freq[largest] -= take;
+				sum -= take;
+			}
+		}
+		finalize();
+	}
+
+	// | number of symbols (2B) | symbol (1B) frequency (2B) | ... |
+	size_t serialize(char *out) const{
+		size_t offset = sizeof(uint16_t);
+		uint16_t num = 0;
+		for(int i=0;i<256;i++){
+			if(freq[i]){
+				out[offset++] = (uint8_t)i;
+				memcpy(out + offset, &freq[i], sizeof(uint16_t));
+				offset += sizeof(uint16_t);
+				num++;
+			}
+		}
+		memcpy(out, &num, sizeof(uint16_t));
+		return offset;
+	}
+
+	size_t deserialize(const char *in){
+		uint16_t num;
+		memcpy(&num, in, sizeof(uint16_t));
+		size_t offset = sizeof(uint16_t);
+		memset(freq, 0, sizeof(freq));
+		for(uint16_t i=0;i<num;i++){
+			uint8_t sym = in[offset++];
+			memcpy(&freq[sym], in + offset, sizeof(uint16_t));
+			offset += sizeof(uint16_t);
+		}
+		finalize();
+		return offset;
+	}
+
+	static size_t serialized_size(){
+		return sizeof(uint16_t) + 256*(1+sizeof(uint16_t));
+	}
+
+private:
+	void finalize(){
+		cum[0] = 0;
+		for(int i=0;i<256;i++){
+			cum[i+1] = cum[i] + freq[i];
+		}
+		assert(cum[256]==RANS_SCALE);
+		for(int i=0;i<256;i++){
+			memset(slot + cum[i], i, freq[i]);
+		}
+	}
+};
+
+/*
+ * encode n bytes with the given model, all symbols must have a non-zero
+ * frequency. rANS works as a stack, so the symbols are pushed backwards
+ * and the output is | final state (4B) | renormalization bytes |
+ * */
+inline void rans_encode(const rans_model &model, const uint8_t *in, size_t n, vector<uint8_t> &out){
+	// one symbol emits at most RANS_SCALE_BITS bits
+	vector<uint8_t> buffer(2*n + sizeof(uint32_t));
+	uint8_t *ptr = buffer.data() + buffer.size();
+	uint32_t x = RANS_L;
+	for(size_t i=n;i>0;i--){
+		const uint8_t s = in[i-1];
+		const uint32_t f = model.freq[s];
+		assert(f>0);
+		const uint32_t x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * f;
+		while(x >= x_max){
+			*--ptr = (uint8_t)(x & 0xff);
+			x >>= 8;
+		}
+		x = ((x / f) << RANS_SCALE_BITS) + (x % f) + model.cum[s];
+	}
+	ptr -= sizeof(uint32_t);
+	ptr[0] = (uint8_t)(x);
+	ptr[1] = (uint8_t)(x >> 8);
+	ptr[2] = (uint8_t)(x >> 16);
+	ptr[3] = (uint8_t)(x >> 24);
+	out.assign(ptr, buffer.data() + buffer.size());
+}
+
+class rans_decoder{
+	const rans_model *model;
+	const uint8_t *ptr;
+	uint32_t x;
+public:
+	rans_decoder(const rans_model *m, const char *in){
+		model = m;
+		ptr = (const uint8_t *)in;
+		x = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+		ptr += sizeof(uint32_t);
+	}
+
+	inline uint8_t get(){
+		const uint32_t s = x & (RANS_SCALE - 1);
+		const uint8_t sym = model->slot[s];
+		x = model->freq[sym] * (x >> RANS_SCALE_BITS) + s - model->cum[sym];
+		while(x < RANS_L){
+			x = (x << 8) | *ptr++;
+		}
+		return sym;
+	}
+};
+
+/*
+ * integer helpers for the prediction residuals
+ * */
+inline uint32_t zigzag_encode(int32_t v){
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+inline int32_t zigzag_decode(uint32_t v){
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+inline void append_varint(vector<uint8_t> &out, uint32_t v){
+	while(v >= 0x80){
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+inline uint32_t decode_varint(rans_decoder &dec){
+	uint32_t v = 0;
+	int shift = 0;
+	uint8_t b;
+	do{
+		b = dec.get();
+		v |= (uint32_t)(b & 0x7f) << shift;
+		shift += 7;
+	}while(b & 0x80);
+	return v;
+}
+
+}
+
+#endif /* TDBASE_RANS_H_ */
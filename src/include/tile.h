@@ -17,29 +17,108 @@ using namespace std;
 
 namespace tdbase{
 
+/*
+ * the layout of a versioned tile file:
+ *
+ * | type(1B) | object 0 | object 1 | ... | footer | trailer |
+ *
+ * footer:  the number of objects, and for each object the offset
+ * 			and length of its record in the file and its MBB,
+ * 			followed by the MBB of the whole tile and (since
+ * 			version 3) the flattened octree of the objects, which
+ * 			is rebuilt on loading if missing (size is 0)
+ * trailer: the offset of the footer, the format version and a
+ * 			magic number which tells the versioned files from
+ * 			the legacy ones (without footer and trailer)
+ * */
+#define TILE_FORMAT_MAGIC 0x54424454 // "TDBT"
+#define TILE_FORMAT_VERSION 3
+#define OCTREE_LEAF_SIZE 10
+
+typedef struct tile_trailer{
+	size_t footer_offset = 0;
+	uint32_t version = TILE_FORMAT_VERSION;
+	uint32_t magic = TILE_FORMAT_MAGIC;
+}tile_trailer;
+
+// location of one object record in the tile file
+typedef struct object_entry{
+	size_t offset = 0;
+	size_t length = 0;
+	aab box;
+}object_entry;
+
 class Tile{
 	aab space;
 	std::vector<HiMesh_Wrapper *> objects;
 	char *data_buffer = NULL;
 	size_t data_size = 0;
+	// the data buffer is mapped from the tile file rather than allocated
+	bool mapped = false;
 	size_t tile_capacity = INT_MAX;
 	string tile_path;
+	// tiles loaded from the same file share the cached LODs
+	size_t tile_key = 0;
+
+	// for the versioned tile files
+	Decoding_Type dtype = COMPRESSED;
+	uint32_t version = 1;
+	vector<object_entry> entries;
+	// location of the persisted octree in the file
+	size_t octree_offset = 0;
+	size_t octree_length = 0;
+	// buffers for the objects fetched individually
+	vector<char *> object_buffers;
+	int tile_fd = -1;
+	pthread_mutex_t lock;
 
 	OctreeNode *tree = NULL;
+	// built on demand when selected
+	STRTree *str_tree = NULL;
+	// index over the voxels of all the objects, built on demand. the
+	// id of an indexed box locates its owner object and voxel
+	STRTree *voxel_tree = NULL;
+	vector<weighted_aab> voxel_boxes;
+	vector<pair<int, Voxel *>> indexed_voxels;
 public:
 	// for building tile instead of load from file
 	Tile(std::vector<HiMesh_Wrapper *> &objs);
 	Tile(std::string path, size_t capacity=LONG_MAX, bool active_load=true);
 	~Tile();
 	void load();
+	// read only the footer, objects are then fetched on demand
+	void open();
+private:
+	void read_buffer();
+	void map_buffer();
+	void release_buffer();
+	bool read_at(char *buffer, size_t length, size_t offset);
+	bool parse_trailer(const char *trailer);
+	void parse_footer(const char *footer, size_t length, size_t footer_offset);
+	HiMesh_Wrapper *load_object(int id);
+	size_t dump_footer(ofstream *os, size_t footer_offset);
+public:
 
+	// the objects fetched on demand are published by load_object()
+	// with a release store, which pairs with the acquire loads here
 	inline HiMesh_Wrapper *get_mesh_wrapper(int id){
 		assert(id>=0&&id<objects.size());
-		return objects[id];
+		HiMesh_Wrapper *wrapper = __atomic_load_n(&objects[id], __ATOMIC_ACQUIRE);
+		if(wrapper == NULL){
+			wrapper = load_object(id);
+		}
+		return wrapper;
 	}
 	inline aab get_mbb(int id){
 		assert(id>=0&&id<objects.size());
-		return objects[id]->box;
+		HiMesh_Wrapper *wrapper = __atomic_load_n(&objects[id], __ATOMIC_ACQUIRE);
+		if(wrapper == NULL){
+			return entries[id].box;
+		}
+		return wrapper->box;
+	}
+	inline uint32_t get_version(){
+		return version;
 	}
 
 	inline size_t num_objects(){
@@ -52,6 +131,14 @@ public:
 	inline OctreeNode *get_octree(){
 		return tree;
 	}
+	// the index over the objects selected with --index
+	ObjectIndex *get_index();
+	// the index over the voxels of the objects, enabled with --voxel_index
+	STRTree *get_voxel_index();
+	inline pair<int, Voxel *> &get_indexed_voxel(int id){
+		assert(id>=0&&id<indexed_voxels.size());
+		return indexed_voxels[id];
+	}
 
 	void dump_compressed(const char *path);
 	void dump_raw(const char *path);
@@ -16,6 +16,7 @@ OctreeNode::OctreeNode(aab b, int _level, long tsize) {
 
 OctreeNode::~OctreeNode() {
 	objectList.clear();
+	objectBoxes.clear();
 	if(!isLeaf){
 		for(OctreeNode *c:children){
 			delete c;
@@ -35,10 +36,12 @@ bool OctreeNode::addObject(weighted_aab *object) {
 		// newly added node must be a leaf
 		assert(isLeaf);
 		objectList.push_back(object);
+		objectBoxes.push_back(*object);
 		return true;
 	}
 	if (isLeaf) {
 		objectList.push_back(object);
+		objectBoxes.push_back(*object);
 		/* Temporary variables */
 		if (size > tile_size && canBeSplit) {
 			/* Update the center */
@@ -83,6 +86,7 @@ bool OctreeNode::addObject(weighted_aab *object) {
 				}
 			} else {
 				objectList.clear();
+				objectBoxes.clear();
 				isLeaf = false;
 			}
 		} else if (size > 1.5 * tile_size) {
@@ -115,7 +119,7 @@ inline float get_max_maxdist(vector<pair<int, range>> &results){
 	return maxmaxdist;
 }
 
-inline bool add_candidate(vector<pair<int, range>> &candidates, size_t id, range dist, int k){
+bool add_candidate(vector<pair<int, range>> &candidates, size_t id, range dist, int k){
 	// can be inserted
 	if(candidates.size()<k || dist.mindist <candidates[k-1].second.maxdist){
 		int inserted_loc = 0;
@@ -178,59 +182,163 @@ inline bool add_candidate(vector<pair<int, range>> &candidates, size_t id, range
 //
 //}
 
+/*
+ * the objects visited by the current query of this thread, for skipping the
+ * ones replicated in multiple leaves. a new query bumps the epoch instead of
+ * clearing the stamps, which are indexed by the object id
+ * */
+class visit_stamps{
+	vector<uint32_t> stamps;
+	uint32_t epoch = 0;
+public:
+	inline void reset(){
+		if(++epoch == 0){
+			std::fill(stamps.begin(), stamps.end(), 0);
+			epoch = 1;
+		}
+	}
+	// return false if it is visited already
+	inline bool visit(int id){
+		assert(id>=0);
+		if(id>=stamps.size()){
+			stamps.resize(max((size_t)id+1, 2*stamps.size()), 0);
+		}
+		if(stamps[id] == epoch){
+			return false;
+		}
+		stamps[id] = epoch;
+		return true;
+	}
+	static visit_stamps &local(){
+		static thread_local visit_stamps vs;
+		return vs;
+	}
+};
+
+/*
+ * best-first traversal, the nodes are visited from the nearest one with a
+ * min-heap on their mindist, and the k smallest maxdist found so far are kept
+ * in a bounded max-heap whose top is min_maxdist. the candidates are the same
+ * as those add_candidate() keeps: the k ones with the smallest maxdist, and
+ * the others whose mindist is smaller than the k-th maxdist
+ * */
 void OctreeNode::query_knn(weighted_aab *box, vector<pair<int, range>> &candidates, float &min_maxdist, const int k){
-	range dis = distance(*box);
+	static thread_local vector<pair<float, OctreeNode *>> queue;
+	static thread_local vector<float> kmaxdist;
+	static thread_local vector<range> dists;
+	visit_stamps &visited = visit_stamps::local();
+	auto farther = [](const pair<float, OctreeNode *> &a, const pair<float, OctreeNode *> &b){
+		return a.first>b.first;
+	};
+	queue.clear();
+	kmaxdist.clear();
+	visited.reset();
+	for(pair<int, range> &c:candidates){
+		visited.visit(c.first);
+		kmaxdist.push_back(c.second.maxdist);
+		push_heap(kmaxdist.begin(), kmaxdist.end());
+		if(kmaxdist.size()>k){
+			pop_heap(kmaxdist.begin(), kmaxdist.end());
+			kmaxdist.pop_back();
+		}
+	}
 
-	// current node possibly covers nearest objects dis.mindist<min_maxdist
-	// or the candidate list is not full yet
-	if(dis.mindist<min_maxdist || candidates.size()<k){
-		if(isLeaf){
-			for(weighted_aab *obj:objectList){
-				if(obj==box){// avoid self comparing
-					continue;
-				}
-				range objdis = obj->distance(*box);
-				// min_maxdist is updated
-				if(add_candidate(candidates, obj->id, objdis, k) && candidates.size()>=k){
-					min_maxdist = candidates[k-1].second.maxdist;
-					//log("%f",min_maxdist);
+	queue.push_back(pair<float, OctreeNode *>(distance(*box).mindist, this));
+	while(!queue.empty()){
+		pop_heap(queue.begin(), queue.end(), farther);
+		const float mindist = queue.back().first;
+		OctreeNode *node = queue.back().second;
+		queue.pop_back();
+		// the remaining nodes are all farther
+		if(mindist>=min_maxdist && kmaxdist.size()>=k){
+			break;
+		}
+		if(!node->isLeaf){
+			for(OctreeNode *c:node->children){
+				range dis = c->distance(*box);
+				if(dis.mindist<min_maxdist || kmaxdist.size()<k){
+					queue.push_back(pair<float, OctreeNode *>(dis.mindist, c));
+					push_heap(queue.begin(), queue.end(), farther);
 				}
 			}
-		}else{
-			for(OctreeNode *c:this->children){
-				c->query_knn(box, candidates, min_maxdist, k);
+			continue;
+		}
+		dists.resize(node->objectList.size());
+		box->distance(node->objectBoxes, 0, dists.size(), dists.data());
+		for(size_t o=0;o<node->objectList.size();o++){
+			weighted_aab *obj = node->objectList[o];
+			// avoid self comparing, and the objects
+			// replicated in multiple leaves
+			if(obj==box || !visited.visit(obj->id)){
+				continue;
+			}
+			range &objdis = dists[o];
+			if(kmaxdist.size()>=k && objdis.mindist>=kmaxdist.front()){
+				continue;
+			}
+			candidates.push_back(pair<int, range>(obj->id, objdis));
+			kmaxdist.push_back(objdis.maxdist);
+			push_heap(kmaxdist.begin(), kmaxdist.end());
+			if(kmaxdist.size()>k){
+				pop_heap(kmaxdist.begin(), kmaxdist.end());
+				kmaxdist.pop_back();
+			}
+			// min_maxdist is updated
+			if(kmaxdist.size()>=k){
+				min_maxdist = kmaxdist.front();
 			}
 		}
 	}
+
+	// sort by maxdist and evict the ones not qualified anymore
+	std::stable_sort(candidates.begin(), candidates.end(),
+			[](const pair<int, range> &a, const pair<int, range> &b){
+		return a.second.maxdist<b.second.maxdist;
+	});
+	if(candidates.size()>k){
+		const float kth = candidates[k-1].second.maxdist;
+		candidates.erase(std::remove_if(candidates.begin()+k, candidates.end(),
+				[kth](const pair<int, range> &c){
+			return c.second.mindist>=kth;
+		}), candidates.end());
+	}
 }
 
+// each object is checked once even if it is replicated in multiple leaves
 void OctreeNode::query_within(weighted_aab *box, vector<pair<int, range>> &results, const float threshold){
-	range dis = distance(*box);
-
-	if(dis.mindist<=threshold){
-		if(isLeaf){
-			for(weighted_aab *obj:objectList){
-				if(obj==box){// avoid self comparing
-					continue;
-				}
-				range objdis = obj->distance(*box);
-				if(objdis.mindist<=threshold){
-					// deduplicate
-					bool exist = false;
-					for(pair<int, range> &c:results){
-						if(c.first==obj->id){
-							exist = true;
-							break;
-						}
-					}
-					if(!exist){
-						results.push_back(pair<int, range>(obj->id, objdis));
-					}
-				}
+	static thread_local vector<OctreeNode *> stack;
+	static thread_local vector<range> dists;
+	visit_stamps &visited = visit_stamps::local();
+	visited.reset();
+	for(pair<int, range> &r:results){
+		visited.visit(r.first);
+	}
+	stack.clear();
+	stack.push_back(this);
+	while(!stack.empty()){
+		OctreeNode *node = stack.back();
+		stack.pop_back();
+		range dis = node->distance(*box);
+		if(dis.mindist>threshold){
+			continue;
+		}
+		if(!node->isLeaf){
+			for(OctreeNode *c:node->children){
+				stack.push_back(c);
 			}
-		}else{
-			for(OctreeNode *c:this->children){
-				c->query_within(box, results, threshold);
+			continue;
+		}
+		dists.resize(node->objectList.size());
+		box->distance(node->objectBoxes, 0, dists.size(), dists.data());
+		for(size_t o=0;o<node->objectList.size();o++){
+			weighted_aab *obj = node->objectList[o];
+			// avoid self comparing
+			if(obj==box || !visited.visit(obj->id)){
+				continue;
+			}
+			range &objdis = dists[o];
+			if(objdis.mindist<=threshold){
+				results.push_back(pair<int, range>(obj->id, objdis));
 			}
 		}
 	}
@@ -255,6 +363,85 @@ void OctreeNode::query_intersect(weighted_aab *box, vector<int> &results){
 	}
 }
 
+/*
+ * each node is flattened as
+ * | low[3] | high[3] | size | level | tile_size | isLeaf | canBeSplit |
+ * followed by the number and ids of the objects for a leaf node, or
+ * by its eight children for a non-leaf node
+ * */
+void OctreeNode::serialize(vector<char> &buffer){
+	size_t offset = buffer.size();
+	size_t node_size = 6*sizeof(float) + sizeof(uint32_t) + sizeof(int32_t) + sizeof(int64_t) + 2*sizeof(char);
+	if(isLeaf){
+		node_size += sizeof(uint32_t) + objectList.size()*sizeof(int32_t);
+	}
+	buffer.resize(offset + node_size);
+	char *data = buffer.data();
+
+	memcpy(data + offset, low, 3*sizeof(float));
+	offset += 3*sizeof(float);
+	memcpy(data + offset, high, 3*sizeof(float));
+	offset += 3*sizeof(float);
+	*(uint32_t *)(data + offset) = size;
+	offset += sizeof(uint32_t);
+	*(int32_t *)(data + offset) = level;
+	offset += sizeof(int32_t);
+	*(int64_t *)(data + offset) = tile_size;
+	offset += sizeof(int64_t);
+	data[offset++] = isLeaf;
+	data[offset++] = canBeSplit;
+
+	if(isLeaf){
+		*(uint32_t *)(data + offset) = objectList.size();
+		offset += sizeof(uint32_t);
+		for(weighted_aab *obj:objectList){
+			*(int32_t *)(data + offset) = obj->id;
+			offset += sizeof(int32_t);
+		}
+	}else{
+		for(OctreeNode *c:children){
+			c->serialize(buffer);
+		}
+	}
+}
+
+OctreeNode *OctreeNode::deserialize(const char *buffer, size_t &offset, vector<weighted_aab *> &objects){
+	aab b;
+	memcpy(b.low, buffer + offset, 3*sizeof(float));
+	offset += 3*sizeof(float);
+	memcpy(b.high, buffer + offset, 3*sizeof(float));
+	offset += 3*sizeof(float);
+	uint32_t sz = *(uint32_t *)(buffer + offset);
+	offset += sizeof(uint32_t);
+	int32_t lv = *(int32_t *)(buffer + offset);
+	offset += sizeof(int32_t);
+	int64_t tsize = *(int64_t *)(buffer + offset);
+	offset += sizeof(int64_t);
+
+	OctreeNode *node = new OctreeNode(b, lv, tsize);
+	node->size = sz;
+	node->isLeaf = buffer[offset++];
+	node->canBeSplit = buffer[offset++];
+
+	if(node->isLeaf){
+		uint32_t num = *(uint32_t *)(buffer + offset);
+		offset += sizeof(uint32_t);
+		node->objectList.reserve(num);
+		for(uint32_t i=0;i<num;i++){
+			int32_t id = *(int32_t *)(buffer + offset);
+			offset += sizeof(int32_t);
+			assert(id>=0 && id<objects.size());
+			node->objectList.push_back(objects[id]);
+			node->objectBoxes.push_back(*objects[id]);
+		}
+	}else{
+		for(int i=0;i<8;i++){
+			node->children[i] = deserialize(buffer, offset, objects);
+		}
+	}
+	return node;
+}
+
 OctreeNode *build_octree(std::vector<weighted_aab*> &voxels, int leaf_size){
 	// the main thread build the OCTree with the Minimum Boundary Box
 	// get from the data
@@ -0,0 +1,216 @@
+/*
+ * strtree.cpp
+ *
+ *  the Sort-Tile-Recursive bulk-loaded R-tree
+ *
+ */
+
+#include "index.h"
+
+using namespace std;
+
+namespace tdbase{
+
+/*
+ * order the items for packing them into nodes of the given capacity. the
+ * items are sorted by x and cut into slabs, each slab is sorted by y and cut
+ * into strips, and each strip is sorted by z, so the runs of capacity items
+ * are tiles of the space
+ * */
+template<class BoxOf>
+static void str_order(vector<uint32_t> &items, size_t capacity, BoxOf box_of){
+	const size_t n = items.size();
+	const size_t num_nodes = (n+capacity-1)/capacity;
+	const size_t slices = max((size_t)ceil(cbrt((double)num_nodes)), (size_t)1);
+	auto sort_by = [&](size_t begin, size_t end, int d){
+		std::sort(items.begin()+begin, items.begin()+end, [&](uint32_t a, uint32_t b){
+			const aab &ba = box_of(a);
+			const aab &bb = box_of(b);
+			return ba.low[d]+ba.high[d] < bb.low[d]+bb.high[d];
+		});
+	};
+	sort_by(0, n, 0);
+	const size_t slab = slices*slices*capacity;
+	const size_t strip = slices*capacity;
+	for(size_t x=0;x<n;x+=slab){
+		const size_t x_end = min(x+slab, n);
+		sort_by(x, x_end, 1);
+		for(size_t y=x;y<x_end;y+=strip){
+			sort_by(y, min(y+strip, x_end), 2);
+		}
+	}
+}
+
+STRTree::STRTree(vector<weighted_aab *> &objs, size_t capacity){
+	capacity = max(capacity, (size_t)2);
+	vector<uint32_t> items(objs.size());
+	for(uint32_t i=0;i<items.size();i++){
+		items[i] = i;
+	}
+	str_order(items, capacity, [&](uint32_t i)->const aab &{
+		return *objs[i];
+	});
+	objects.reserve(objs.size());
+	for(uint32_t i:items){
+		objects.push_back(objs[i]);
+	}
+	objectBoxes.assign(objects);
+
+	// the leaf nodes
+	for(size_t i=0;i<objects.size();i+=capacity){
+		STRNode node;
+		node.first = i;
+		node.count = min(capacity, objects.size()-i);
+		node.isLeaf = true;
+		for(uint32_t o=node.first;o<node.first+node.count;o++){
+			node.box.update(*objects[o]);
+		}
+		nodes.push_back(node);
+	}
+	// an empty root for an empty tree
+	if(nodes.empty()){
+		nodes.push_back(STRNode());
+		return;
+	}
+
+	// the upper levels, each level is reordered in place before it is packed,
+	// which keeps the children of each node contiguous
+	size_t level_begin = 0;
+	while(nodes.size()-level_begin > 1){
+		const size_t level_end = nodes.size();
+		items.resize(level_end-level_begin);
+		for(uint32_t i=0;i<items.size();i++){
+			items[i] = level_begin+i;
+		}
+		str_order(items, capacity, [&](uint32_t i)->const aab &{
+			return nodes[i].box;
+		});
+		vector<STRNode> level;
+		level.reserve(items.size());
+		for(uint32_t i:items){
+			level.push_back(nodes[i]);
+		}
+		std::copy(level.begin(), level.end(), nodes.begin()+level_begin);
+
+		for(size_t i=level_begin;i<level_end;i+=capacity){
+			STRNode node;
+			node.first = i;
+			node.count = min(capacity, level_end-i);
+			node.isLeaf = false;
+			for(uint32_t c=node.first;c<node.first+node.count;c++){
+				node.box.update(nodes[c].box);
+			}
+			nodes.push_back(node);
+		}
+		level_begin = level_end;
+	}
+}
+
+// the children are visited from the nearest one to tighten min_maxdist early
+void STRTree::query_knn(uint32_t id, weighted_aab *box, vector<pair<int, range>> &candidates, float &min_maxdist, const int k){
+	static thread_local vector<range> dists;
+	// the children of all the nodes on the path, shared by the recursion
+	static thread_local vector<pair<float, uint32_t>> children;
+	STRNode &node = nodes[id];
+	if(node.isLeaf){
+		dists.resize(node.count);
+		box->distance(objectBoxes, node.first, node.count, dists.data());
+		for(uint32_t o=node.first;o<node.first+node.count;o++){
+			weighted_aab *obj = objects[o];
+			if(obj==box){// avoid self comparing
+				continue;
+			}
+			range &objdis = dists[o-node.first];
+			// min_maxdist is updated
+			if(add_candidate(candidates, obj->id, objdis, k) && candidates.size()>=k){
+				min_maxdist = candidates[k-1].second.maxdist;
+			}
+		}
+		return;
+	}
+	const size_t begin = children.size();
+	for(uint32_t c=0;c<node.count;c++){
+		children.push_back(pair<float, uint32_t>(nodes[node.first+c].box.distance(*box).mindist, node.first+c));
+	}
+	std::sort(children.begin()+begin, children.end());
+	for(size_t c=begin;c<begin+node.count;c++){
+		// current node possibly covers nearest objects
+		// or the candidate list is not full yet
+		if(children[c].first<min_maxdist || candidates.size()<k){
+			query_knn(children[c].second, box, candidates, min_maxdist, k);
+		}
+	}
+	children.resize(begin);
+}
+
+void STRTree::query_knn(weighted_aab *box, vector<pair<int, range>> &candidates, float &min_maxdist, const int k){
+	const uint32_t root = nodes.size()-1;
+	if(nodes[root].count == 0){
+		return;
+	}
+	if(nodes[root].box.distance(*box).mindist<min_maxdist || candidates.size()<k){
+		query_knn(root, box, candidates, min_maxdist, k);
+	}
+}
+
+void STRTree::query_within(weighted_aab *box, vector<pair<int, range>> &results, const float threshold){
+	static thread_local vector<uint32_t> stack;
+	static thread_local vector<range> dists;
+	stack.clear();
+	stack.push_back(nodes.size()-1);
+	while(!stack.empty()){
+		STRNode &node = nodes[stack.back()];
+		stack.pop_back();
+		if(node.count == 0 || node.box.distance(*box).mindist>threshold){
+			continue;
+		}
+		if(!node.isLeaf){
+			for(uint32_t c=node.first;c<node.first+node.count;c++){
+				stack.push_back(c);
+			}
+			continue;
+		}
+		dists.resize(node.count);
+		box->distance(objectBoxes, node.first, node.count, dists.data());
+		for(uint32_t o=node.first;o<node.first+node.count;o++){
+			weighted_aab *obj = objects[o];
+			if(obj==box){// avoid self comparing
+				continue;
+			}
+			range &objdis = dists[o-node.first];
+			if(objdis.mindist<=threshold){
+				results.push_back(pair<int, range>(obj->id, objdis));
+			}
+		}
+	}
+}
+
+void STRTree::query_intersect(weighted_aab *box, vector<int> &results){
+	static thread_local vector<uint32_t> stack;
+	stack.clear();
+	stack.push_back(nodes.size()-1);
+	while(!stack.empty()){
+		STRNode &node = nodes[stack.back()];
+		stack.pop_back();
+		if(node.count == 0 || !node.box.intersect(*box)){
+			continue;
+		}
+		if(!node.isLeaf){
+			for(uint32_t c=node.first;c<node.first+node.count;c++){
+				stack.push_back(c);
+			}
+			continue;
+		}
+		for(uint32_t o=node.first;o<node.first+node.count;o++){
+			weighted_aab *obj = objects[o];
+			if(obj==box){// avoid self comparing
+				continue;
+			}
+			if(obj->intersect(*box)){
+				results.push_back(obj->id);
+			}
+		}
+	}
+}
+
+}
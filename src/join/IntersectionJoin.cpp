@@ -9,14 +9,31 @@
 
 namespace tdbase{
 
-vector<candidate_entry *> SpatialJoin::mbb_intersect(Tile *tile1, Tile *tile2){
+vector<candidate_entry *> SpatialJoin::mbb_intersect(Tile *tile1, Tile *tile2, query_context &ctx){
 	vector<candidate_entry *> candidates;
-	OctreeNode *tree = tile2->get_octree();
+	ObjectIndex *tree = tile2->get_index();
+	STRTree *voxel_index = ctx.use_voxel_index ? tile2->get_voxel_index() : NULL;
 #pragma omp parallel for
 	for(int i=0;i<tile1->num_objects();i++){
 		vector<int> candidate_ids;
 		HiMesh_Wrapper *wrapper1 = tile1->get_mesh_wrapper(i);
 
+		if(voxel_index){
+			// only the intersecting voxel pairs are retrieved
+			vector<candidate_info> cis;
+			index_voxel_pairs(wrapper1, tile2, voxel_index, -1, cis);
+			if(cis.empty()){
+				continue;
+			}
+			candidate_entry *ce = new candidate_entry(wrapper1);
+			for(candidate_info &ci:cis){
+				ce->add_candidate(ci);
+			}
+#pragma omp critical
+			candidates.push_back(ce);
+			continue;
+		}
+
 		tree->query_intersect(&(wrapper1->box), candidate_ids);
 		// no candidates
 		if(candidate_ids.empty()){
@@ -73,7 +90,7 @@ void SpatialJoin::intersect(query_context ctx){
 	struct timeval very_start = get_cur_time();
 
 	// filtering with MBBs to get the candidate list
-	vector<candidate_entry *> candidates = mbb_intersect(ctx.tile1, ctx.tile2);
+	vector<candidate_entry *> candidates = mbb_intersect(ctx.tile1, ctx.tile2, ctx);
 	ctx.index_time += tdbase::get_time_elapsed(start,false);
 	logt("index retrieving", start);
 
@@ -138,7 +155,8 @@ void SpatialJoin::intersect(query_context ctx){
 				ce_iter++;
 			}
 		}
-		delete []ctx.results;
+		// the buffer of the results is kept for the next LOD
+		ctx.results = NULL;
 		ctx.updatelist_time += logt("update the candidate list", start);
 
 		logt("evaluating with lod %d", iter_start, lod);
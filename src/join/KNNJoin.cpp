@@ -125,9 +125,38 @@ void evaluate_candidate_lists(vector<candidate_entry *> &candidates, query_conte
 	}
 }
 
+/*
+ * the voxel pairs of a candidate which may hold the closest voxel pair
+ * */
+static candidate_info knn_voxel_pairs(HiMesh_Wrapper *wrapper1, HiMesh_Wrapper *wrapper2){
+	candidate_info ci(wrapper2);
+	float min_maxdist = DBL_MAX;
+	static thread_local vector<range> dists;
+	dists.resize(wrapper2->voxels.size());
+	for(Voxel *v1:wrapper1->voxels){
+		v1->distance(wrapper2->voxel_boxes, 0, dists.size(), dists.data());
+		for(int j=0;j<wrapper2->voxels.size();j++){
+			Voxel *v2 = wrapper2->voxels[j];
+			range &dist_vox = dists[j];
+			if(dist_vox.mindist>=min_maxdist){
+				continue;
+			}
+			// wait for later evaluation
+			ci.voxel_pairs.push_back(voxel_pair(v1, v2, dist_vox));
+			min_maxdist = min(min_maxdist, dist_vox.maxdist);
+		}
+	}
+	// form the distance range of objects with the evaluations of voxel pairs
+	ci.distance = update_voxel_pair_list(ci.voxel_pairs, min_maxdist);
+	assert(ci.voxel_pairs.size()>0);
+	assert(ci.distance.mindist<=ci.distance.maxdist);
+	return ci;
+}
+
 vector<candidate_entry *> SpatialJoin::mbb_knn(Tile *tile1, Tile *tile2, query_context &ctx){
 	vector<candidate_entry *> candidates;
-	OctreeNode *tree = tile2->get_octree();
+	ObjectIndex *tree = tile2->get_index();
+	STRTree *voxel_index = ctx.use_voxel_index ? tile2->get_voxel_index() : NULL;
 	size_t tile1_size = min(tile1->num_objects(), ctx.max_num_objects1);
 
 #pragma omp parallel for
@@ -153,26 +182,47 @@ vector<candidate_entry *> SpatialJoin::mbb_knn(Tile *tile1, Tile *tile2, query_c
 
 		//2. we further go through the voxels in two objects to shrink
 		// 	 the candidate list in a finer grain
-		for(pair<int, range> &p:candidate_ids){
-			HiMesh_Wrapper *wrapper2 = tile2->get_mesh_wrapper(p.first);
-			candidate_info ci(wrapper2);
-			float min_maxdist = DBL_MAX;
-			for(Voxel *v1:wrapper1->voxels){
-				for(Voxel *v2:wrapper2->voxels){
-					range dist_vox = v1->distance(*v2);
-					if(dist_vox.mindist>=min_maxdist){
+		if(voxel_index){
+			// the voxel pairs of all the candidates are retrieved with
+			// one query bounded by the largest maxdist of the candidates
+			float max_maxdist = 0;
+			for(pair<int, range> &p:candidate_ids){
+				max_maxdist = max(max_maxdist, p.second.maxdist);
+			}
+			std::sort(candidate_ids.begin(), candidate_ids.end(),
+					[](const pair<int, range> &a, const pair<int, range> &b){return a.first<b.first;});
+			vector<candidate_info> cis;
+			index_voxel_pairs(wrapper1, tile2, voxel_index, max_maxdist, cis);
+			// both lists are ordered by the object id
+			auto ci_iter = cis.begin();
+			for(pair<int, range> &p:candidate_ids){
+				while(ci_iter!=cis.end() && ci_iter->mesh_wrapper->box.id<p.first){
+					ci_iter++;
+				}
+				if(ci_iter!=cis.end() && ci_iter->mesh_wrapper->box.id==p.first){
+					candidate_info &ci = *ci_iter;
+					float min_maxdist = DBL_MAX;
+					for(voxel_pair &vp:ci.voxel_pairs){
+						min_maxdist = min(min_maxdist, vp.dist.maxdist);
+					}
+					// the voxel pairs beyond the threshold are missing, which
+					// is only fine if they will be evicted anyway
+					if(min_maxdist<=max_maxdist){
+						ci.distance = update_voxel_pair_list(ci.voxel_pairs, min_maxdist);
+						assert(ci.voxel_pairs.size()>0);
+						ce->add_candidate(ci);
 						continue;
 					}
-					// wait for later evaluation
-					ci.voxel_pairs.push_back(voxel_pair(v1, v2, dist_vox));
-					min_maxdist = min(min_maxdist, dist_vox.maxdist);
 				}
+				// go through all the voxel pairs otherwise
+				candidate_info ci = knn_voxel_pairs(wrapper1, tile2->get_mesh_wrapper(p.first));
+				ce->add_candidate(ci);
+			}
+		}else{
+			for(pair<int, range> &p:candidate_ids){
+				candidate_info ci = knn_voxel_pairs(wrapper1, tile2->get_mesh_wrapper(p.first));
+				ce->add_candidate(ci);
 			}
-			// form the distance range of objects with the evaluations of voxel pairs
-			ci.distance = update_voxel_pair_list(ci.voxel_pairs, min_maxdist);
-			assert(ci.voxel_pairs.size()>0);
-			assert(ci.distance.mindist<=ci.distance.maxdist);
-			ce->add_candidate(ci);
 		}
 
 		//log("%ld %ld", candidate_ids.size(),candidate_list.size());
@@ -257,16 +307,24 @@ void SpatialJoin::nearest_neighbor(query_context ctx){
 						if(vp.v1->num_triangles>0&&vp.v2->num_triangles>0){
 							range dist = vp.dist;
 							if(lod==ctx.highest_lod()){
-								// now we have a precise distance
-								dist.mindist = res.distance;
-								dist.maxdist = res.distance;
+								if(res.bounded){
+									// some triangle pairs are skipped by the bound
+									dist.mindist = res.min_dist;
+									dist.maxdist = res.distance;
+								}else{
+									// now we have a precise distance
+									dist.mindist = res.distance;
+									dist.maxdist = res.distance;
+								}
 							}else if(global_ctx.hausdorf_level == 2){
 								dist.mindist = std::max(dist.mindist, res.min_dist);
 								dist.maxdist = std::min(dist.maxdist, res.max_dist);
+								ci.bound = std::min(ci.bound, res.max_dist);
 //								dist.maxdist = std::min(dist.maxdist, res.distance);
 							}else if(global_ctx.hausdorf_level == 1){
 								dist.mindist = std::max(dist.mindist, res.distance - wrapper1->getHausdorffDistance() - wrapper2->getHausdorffDistance());
 								dist.maxdist = std::min(dist.maxdist, res.distance + wrapper1->getProxyHausdorffDistance() + wrapper2->getProxyHausdorffDistance());
+								ci.bound = std::min(ci.bound, res.distance + wrapper1->getProxyHausdorffDistance() + wrapper2->getProxyHausdorffDistance());
 //								dist.maxdist = std::min(dist.maxdist, res.distance);
 							}else if(global_ctx.hausdorf_level == 0){
 								dist.maxdist = std::min(dist.maxdist, res.distance);
@@ -299,7 +357,8 @@ void SpatialJoin::nearest_neighbor(query_context ctx){
 		}
 		// update the list after processing each LOD
 		evaluate_candidate_lists(candidates, ctx);
-		delete []ctx.results;
+		// the buffer of the results is kept for the next LOD
+		ctx.results = NULL;
 		ctx.updatelist_time += logt("updating the candidate lists",start);
 
 		logt("evaluating with lod %d", iter_start, lod);
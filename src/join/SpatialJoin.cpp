@@ -9,6 +9,8 @@
 #include <map>
 #include <tuple>
 #include <string.h>
+#include <unordered_set>
+#include <unordered_map>
 #include "SpatialJoin.h"
 
 using namespace std;
@@ -63,15 +65,131 @@ range SpatialJoin::update_voxel_pair_list(vector<voxel_pair> &voxel_pairs, doubl
 	return ret;
 }
 
+/*
+ * query the voxel index of tile2 with each voxel of the object, the voxel pairs
+ * within the threshold, or the intersecting ones if it is negative, are grouped
+ * into one candidate_info for each object owning the voxels in tile2
+ * */
+void SpatialJoin::index_voxel_pairs(HiMesh_Wrapper *wrapper1, Tile *tile2, STRTree *index, float threshold, vector<candidate_info> &cis){
+	static thread_local vector<pair<int, range>> within_ids;
+	static thread_local vector<int> intersect_ids;
+	static thread_local vector<pair<int, voxel_pair>> pairs;
+	pairs.clear();
+	weighted_aab box;
+	for(Voxel *v1:wrapper1->voxels){
+		box.set_box(*v1);
+		if(threshold<0){
+			intersect_ids.clear();
+			index->query_intersect(&box, intersect_ids);
+			for(int id:intersect_ids){
+				pair<int, Voxel *> &iv = tile2->get_indexed_voxel(id);
+				pairs.push_back(pair<int, voxel_pair>(iv.first, voxel_pair(v1, iv.second)));
+			}
+		}else{
+			within_ids.clear();
+			index->query_within(&box, within_ids, threshold);
+			for(pair<int, range> &r:within_ids){
+				pair<int, Voxel *> &iv = tile2->get_indexed_voxel(r.first);
+				pairs.push_back(pair<int, voxel_pair>(iv.first, voxel_pair(v1, iv.second, r.second)));
+			}
+		}
+	}
+
+	// group by the owner objects
+	std::stable_sort(pairs.begin(), pairs.end(),
+			[](const pair<int, voxel_pair> &a, const pair<int, voxel_pair> &b){
+		return a.first<b.first;
+	});
+	int former = -1;
+	bool skip = false;
+	for(pair<int, voxel_pair> &p:pairs){
+		if(p.first != former){
+			HiMesh_Wrapper *wrapper2 = tile2->get_mesh_wrapper(p.first);
+			former = p.first;
+			// avoid self comparing
+			skip = (wrapper2 == wrapper1);
+			if(!skip){
+				cis.push_back(candidate_info(wrapper2));
+			}
+		}
+		if(!skip){
+			cis.back().voxel_pairs.push_back(p.second);
+		}
+	}
+}
+
 void SpatialJoin::decode_data(vector<candidate_entry *> &candidates, query_context &ctx){
-	// decode the objects to current lod
+	// collect the distinct objects, one object (e.g. a vessel)
+	// can appear in the candidate lists of many targets
+	vector<HiMesh_Wrapper *> wrappers;
+	unordered_set<HiMesh_Wrapper *> visited;
 	for(candidate_entry *c:candidates){
-		HiMesh_Wrapper *wrapper1 = c->mesh_wrapper;
-		wrapper1->decode_to(ctx.cur_lod);
+		if(visited.insert(c->mesh_wrapper).second){
+			wrappers.push_back(c->mesh_wrapper);
+		}
 		for(candidate_info &info:c->candidates){
-			info.mesh_wrapper->decode_to(ctx.cur_lod);
+			if(visited.insert(info.mesh_wrapper).second){
+				wrappers.push_back(info.mesh_wrapper);
+			}
 		}// end for distance_candiate list
 	}// end for candidates
+
+	// decode the objects to current lod in parallel
+#pragma omp parallel for num_threads(max(ctx.num_compute_thread, 1)) schedule(dynamic)
+	for(size_t i=0;i<wrappers.size();i++){
+		wrappers[i]->decode_to(ctx.cur_lod);
+	}
+}
+
+/*
+ * the reference packing, each voxel gets an index in the order they are
+ * first visited, and the kernels read its triangles and hausdorff distances
+ * in place, the voxels stay untouched until the computation is done
+ * */
+geometry_param SpatialJoin::packing_references(vector<candidate_entry *> &candidates, query_context &ctx, geometry_param &gp){
+	unordered_map<Voxel *, uint32_t> voxel_index;
+	vector<Voxel *> voxels;
+	for(candidate_entry *c:candidates){
+		for(candidate_info &info:c->candidates){
+			for(voxel_pair &vp:info.voxel_pairs){
+				gp.element_pair_num += vp.v1->num_triangles*vp.v2->num_triangles;
+				for(int i=0;i<2;i++){
+					Voxel *tv = (i==0?vp.v1:vp.v2);
+					if(voxel_index.emplace(tv, voxels.size()).second){
+						voxels.push_back(tv);
+					}
+				}
+			}
+		}
+	}
+	gp.element_num = voxels.size();
+	gp.allocate_buffer();
+	if(ctx.use_bvh){
+		gp.trees = gp.borrow<const triangle_bvh *>(BUFFER_TREES, 2*gp.pair_num);
+	}
+	for(uint32_t v=0;v<voxels.size();v++){
+		gp.voxel_triangles[v] = voxels[v]->triangles;
+		gp.voxel_hausdorff[v] = voxels[v]->hausdorff;
+	}
+
+	int index = 0;
+	for(candidate_entry *c:candidates){
+		for(candidate_info &info:c->candidates){
+			for(voxel_pair &vp:info.voxel_pairs){
+				gp.offset_size[4*index] = voxel_index[vp.v1];
+				gp.offset_size[4*index+1] = vp.v1->num_triangles;
+				gp.offset_size[4*index+2] = voxel_index[vp.v2];
+				gp.offset_size[4*index+3] = vp.v2->num_triangles;
+				if(gp.trees){
+					gp.trees[2*index] = &vp.v1->bvh;
+					gp.trees[2*index+1] = &vp.v2->bvh;
+				}
+				index++;
+			}
+		}
+	}
+	assert(index==gp.pair_num);
+	return gp;
 }
 
 geometry_param SpatialJoin::packing_data(vector<candidate_entry *> &candidates, query_context &ctx){
@@ -80,6 +198,12 @@ geometry_param SpatialJoin::packing_data(vector<candidate_entry *> &candidates,
 	gp.element_num = 0;
 	gp.element_pair_num = 0;
 	gp.results = ctx.results;
+	gp.soa = ctx.packing=="soa";
+	gp.reference = ctx.packing=="ref";
+	gp.hugepage = ctx.use_hugepage;
+	if(gp.reference){
+		return packing_references(candidates, ctx, gp);
+	}
 	map<Voxel *, uint32_t> voxel_offset_map;
 
 	for(candidate_entry *c:candidates){
@@ -95,7 +219,12 @@ geometry_param SpatialJoin::packing_data(vector<candidate_entry *> &candidates,
 					if(voxel_offset_map.find(tv)==voxel_offset_map.end()){
 						// the voxel is inserted into the map with an offset
 						voxel_offset_map[tv] = gp.element_num;
-						gp.element_num += tv->num_triangles;
+						if(gp.soa){
+							// each voxel starts a new block of the batched kernel
+							gp.element_num += (tv->num_triangles+TRIDIST_MAX_WIDTH-1)/TRIDIST_MAX_WIDTH*TRIDIST_MAX_WIDTH;
+						}else{
+							gp.element_num += tv->num_triangles;
+						}
 					}
 				}
 			}
@@ -103,11 +232,23 @@ geometry_param SpatialJoin::packing_data(vector<candidate_entry *> &candidates,
 	}
 
 	gp.allocate_buffer();
+	if(ctx.use_bvh){
+		gp.trees = gp.borrow<const triangle_bvh *>(BUFFER_TREES, 2*gp.pair_num);
+	}
 
 	// now we allocate the space and store the data in the buffer
 	for (map<Voxel *, uint32_t>::iterator it=voxel_offset_map.begin(); it!=voxel_offset_map.end(); ++it){
 		Voxel *v = it->first;
-		if(v->num_triangles > 0){
+		if(gp.soa){
+			if(v->num_triangles > 0){
+				const uint32_t offset = it->second;
+				TriDist_transpose(v->triangles, v->num_triangles, gp.stride, gp.data+offset);
+				for(uint32_t t=0;t<v->num_triangles;t++){
+					gp.hausdorff[offset+t] = v->hausdorff[2*t];
+					gp.hausdorff[gp.stride+offset+t] = v->hausdorff[2*t+1];
+				}
+			}
+		}else if(v->num_triangles > 0){
 			memcpy(gp.data+voxel_offset_map[v]*9, v->triangles, v->num_triangles*9*sizeof(float));
 			memcpy(gp.hausdorff+voxel_offset_map[v]*2, v->hausdorff, v->num_triangles*2*sizeof(float));
 		}
@@ -122,6 +263,10 @@ geometry_param SpatialJoin::packing_data(vector<candidate_entry *> &candidates,
 				gp.offset_size[4*index+1] = vp.v1->num_triangles;
 				gp.offset_size[4*index+2] = voxel_offset_map[vp.v2];
 				gp.offset_size[4*index+3] = vp.v2->num_triangles;
+				if(gp.trees){
+					gp.trees[2*index] = &vp.v1->bvh;
+					gp.trees[2*index+1] = &vp.v2->bvh;
+				}
 				index++;
 			}
 		}
@@ -131,12 +276,49 @@ geometry_param SpatialJoin::packing_data(vector<candidate_entry *> &candidates,
 	return gp;
 }
 
+/*
+ * build the AABB trees of the targets, and of the candidates as well for
+ * the distance computation, or their segments for the intersection check.
+ * each mesh is built once in parallel, the trees are kept by the meshes and
+ * reused by the following batches until the meshes advance to the next LOD
+ * */
+void SpatialJoin::build_aabb_trees(vector<candidate_entry *> &candidates, query_context &ctx, bool distance){
+	vector<HiMesh *> trees;
+	vector<HiMesh *> segments;
+	unordered_set<HiMesh *> visited_trees;
+	unordered_set<HiMesh *> visited_segments;
+	for(candidate_entry *c:candidates){
+		HiMesh *mesh = c->mesh_wrapper->get_mesh();
+		if(distance){
+			if(visited_trees.insert(mesh).second){
+				trees.push_back(mesh);
+			}
+		}else if(visited_segments.insert(mesh).second){
+			segments.push_back(mesh);
+		}
+		for(candidate_info &info:c->candidates){
+			HiMesh *target = info.mesh_wrapper->get_mesh();
+			if(visited_trees.insert(target).second){
+				trees.push_back(target);
+			}
+		}
+	}
+#pragma omp parallel for num_threads(max(ctx.num_compute_thread, 1))
+	for(size_t i=0;i<trees.size()+segments.size();i++){
+		if(i<trees.size()){
+			trees[i]->get_aabb_tree_triangle();
+		}else{
+			segments[i-trees.size()]->get_aabb_segments();
+		}
+	}
+}
+
 void SpatialJoin::check_intersection(vector<candidate_entry *> &candidates, query_context &ctx){
 	struct timeval start = tdbase::get_cur_time();
 
 	const int pair_num = get_pair_num(candidates);
 
-	ctx.results = new result_container[pair_num];
+	ctx.results = buffer_arena::local().get<result_container>(BUFFER_RESULTS, pair_num, ctx.use_hugepage);
 	for(int i=0;i<pair_num;i++){
 		ctx.results[i].intersected = false;
 	}
@@ -145,28 +327,17 @@ void SpatialJoin::check_intersection(vector<candidate_entry *> &candidates, quer
 	ctx.decode_time += logt("decode data", start);
 
 	if(ctx.use_aabb){
-		// build the AABB tree
-		for(candidate_entry *c:candidates){
-			for(candidate_info &info:c->candidates){
-				info.mesh_wrapper->get_mesh()->get_aabb_tree_triangle();
-			}
-		}
+		// the segments of the candidates are checked against the trees of their targets
+		build_aabb_trees(candidates, ctx, false);
 		ctx.packing_time += logt("building aabb tree", start);
 
 		int index = 0;
 		for(candidate_entry *c:candidates){
-			c->mesh_wrapper->get_mesh()->get_segments();
 			for(candidate_info &info:c->candidates){
 				assert(info.voxel_pairs.size()==1);
 				ctx.results[index++].intersected = c->mesh_wrapper->get_mesh()->intersect_tree(info.mesh_wrapper->get_mesh());
 			}// end for candidate list
 		}// end for candidates
-		// clear the trees for current LOD
-		for(candidate_entry *c:candidates){
-			for(candidate_info &info:c->candidates){
-				info.mesh_wrapper->get_mesh()->clear_aabb_tree();
-			}
-		}
 		ctx.computation_time += logt("computation for distance computation", start);
 	}else{
 		geometry_param gp = packing_data(candidates, ctx);
@@ -178,27 +349,52 @@ void SpatialJoin::check_intersection(vector<candidate_entry *> &candidates, quer
 }
 
 
+/*
+ * the bounds of the voxel pairs for the bounded MeshDist. for the nn
+ * query, only the distances under the upper bound of a candidate matter,
+ * which is derived from the triangles computed at the former LODs as the
+ * box distances do not bound the distance between the triangles. for the
+ * within query only the ones under the within distance matter, for which
+ * a single triangle pair is enough to tell.
+ * the results of the lower LODs are only used with the triangle level
+ * hausdorff distances, on which the pruning relies
+ * */
+void SpatialJoin::set_distance_bounds(vector<candidate_entry *> &candidates, query_context &ctx, geometry_param &gp){
+	if(ctx.query_type!="nn" && ctx.query_type!="within"){
+		return;
+	}
+	if(ctx.hausdorf_level!=2 && ctx.cur_lod!=ctx.highest_lod()){
+		return;
+	}
+	gp.bounds = gp.borrow<float>(BUFFER_BOUNDS, gp.pair_num);
+	gp.stop_under_bound = ctx.query_type=="within";
+	int index = 0;
+	for(candidate_entry *c:candidates){
+		for(candidate_info &info:c->candidates){
+			for(voxel_pair &vp:info.voxel_pairs){
+				gp.bounds[index++] = ctx.query_type=="within" ? ctx.within_dist : info.bound;
+			}
+		}
+	}
+	assert(index==gp.pair_num);
+}
+
 //utility function to calculate the distances between voxel pairs in batch
 void SpatialJoin::calculate_distance(vector<candidate_entry *> &candidates, query_context &ctx){
 	struct timeval start = tdbase::get_cur_time();
 
 	const int pair_num = get_pair_num(candidates);
-	ctx.results = new result_container[pair_num];
+	ctx.results = buffer_arena::local().get<result_container>(BUFFER_RESULTS, pair_num, ctx.use_hugepage);
 	for(int i=0;i<pair_num;i++){
 		ctx.results[i].distance = 0;
+		ctx.results[i].bounded = false;
 	}
 
 	decode_data(candidates, ctx);
 	ctx.decode_time += logt("decode data", start);
 
 	if(ctx.use_aabb){
-		// build the AABB tree
-		for(candidate_entry *c:candidates){
-			for(candidate_info &info:c->candidates){
-				info.mesh_wrapper->get_mesh()->get_aabb_tree_triangle();
-			}
-			c->mesh_wrapper->get_mesh()->get_aabb_tree_triangle();
-		}
+		build_aabb_trees(candidates, ctx, true);
 		ctx.packing_time += logt("building aabb tree", start);
 
 		int index = 0;
@@ -208,17 +404,11 @@ void SpatialJoin::calculate_distance(vector<candidate_entry *> &candidates, quer
 				ctx.results[index++].distance = c->mesh_wrapper->get_mesh()->distance_tree(info.mesh_wrapper->get_mesh());
 			}// end for distance_candiate list
 		}// end for candidates
-		// clear the trees for current LOD
-		for(candidate_entry *c:candidates){
-			for(candidate_info &info:c->candidates){
-				info.mesh_wrapper->get_mesh()->clear_aabb_tree();
-			}
-			c->mesh_wrapper->get_mesh()->clear_aabb_tree();
-		}
 		ctx.computation_time += logt("computation for distance computation", start);
 
 	}else{
 		geometry_param gp = packing_data(candidates, ctx);
+		set_distance_bounds(candidates, ctx, gp);
 		ctx.packing_time += logt("organizing data with %ld elements and %ld element pairs", start, gp.element_num, gp.element_pair_num);
 		computer->get_distance(gp);
 		gp.clear_buffer();
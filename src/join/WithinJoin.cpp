@@ -23,26 +23,65 @@ inline void print_candidate_within(candidate_entry *cand){
 
 vector<candidate_entry *> SpatialJoin::mbb_within(Tile *tile1, Tile *tile2, query_context &ctx){
 	vector<candidate_entry *> candidates;
-	OctreeNode *tree = tile2->get_octree();
+	ObjectIndex *tree = tile2->get_index();
+	STRTree *voxel_index = ctx.use_voxel_index ? tile2->get_voxel_index() : NULL;
 	size_t tile1_size = min(tile1->num_objects(), ctx.max_num_objects1);
 #pragma omp parallel for
 	for(int i=0;i<tile1_size;i++){
 		vector<pair<int, range>> candidate_ids;
 		HiMesh_Wrapper *wrapper1 = tile1->get_mesh_wrapper(i);
+		if(voxel_index){
+			// the voxel pairs not within the distance are never retrieved
+			vector<candidate_info> cis;
+			index_voxel_pairs(wrapper1, tile2, voxel_index, ctx.within_dist, cis);
+			if(cis.empty()){
+				continue;
+			}
+			candidate_entry *ce = new candidate_entry(wrapper1);
+			for(candidate_info &ci:cis){
+				bool determined = false;
+				float min_maxdist = DBL_MAX;
+				for(voxel_pair &vp:ci.voxel_pairs){
+					// must be within
+					if(vp.dist.maxdist<=ctx.within_dist){
+						determined = true;
+						break;
+					}
+					min_maxdist = min(min_maxdist, vp.dist.maxdist);
+				}
+				if(determined){
+					wrapper1->report_result(ci.mesh_wrapper);
+					continue;
+				}
+				ci.distance = update_voxel_pair_list(ci.voxel_pairs, min_maxdist);
+				ce->add_candidate(ci);
+			}
+			if(ce->candidates.size()>0){
+#pragma omp critical
+				candidates.push_back(ce);
+			}else{
+				delete ce;
+			}
+			continue;
+		}
 		tree->query_within(&(wrapper1->box), candidate_ids, ctx.within_dist);
 		if(candidate_ids.empty()){
 			continue;
 		}
 
+		static thread_local vector<range> dists;
 		candidate_entry *ce = new candidate_entry(wrapper1);
 		for(pair<int, range> &p:candidate_ids){
 			HiMesh_Wrapper *wrapper2 = tile2->get_mesh_wrapper(p.first);
 			candidate_info ci(wrapper2);
 			bool determined = false;
 			float min_maxdist = DBL_MAX;
+			dists.resize(wrapper2->voxels.size());
 			for(Voxel *v1:wrapper1->voxels){
-				for(Voxel *v2:wrapper2->voxels){
-					range dist_vox = v1->distance(*v2);
+				v1->distance(wrapper2->voxel_boxes, 0, dists.size(), dists.data());
+				for(int j=0;j<wrapper2->voxels.size();j++){
+					Voxel *v2 = wrapper2->voxels[j];
+					range &dist_vox = dists[j];
 					// must not within
 					if(dist_vox.mindist>ctx.within_dist){
 						continue;
@@ -158,9 +197,16 @@ void SpatialJoin::within(query_context ctx){
 						if(!determined && vp_iter->v1->num_triangles>0&&vp_iter->v2->num_triangles>0){
 							range dist = vp_iter->dist;
 							if(lod==ctx.highest_lod()){
-								// now we have a precise distance
-								dist.mindist = res.distance;
-								dist.maxdist = res.distance;
+								if(res.bounded){
+									// stopped under the within distance, or the
+									// skipped triangle pairs are all beyond it
+									dist.mindist = res.min_dist;
+									dist.maxdist = res.distance;
+								}else{
+									// now we have a precise distance
+									dist.mindist = res.distance;
+									dist.maxdist = res.distance;
+								}
 							}else if(global_ctx.hausdorf_level == 2){
 								dist.mindist = std::max(dist.mindist, res.min_dist);
 								dist.maxdist = std::min(dist.maxdist, res.max_dist);
@@ -211,7 +257,8 @@ void SpatialJoin::within(query_context ctx){
 				ce_iter++;
 			}
 		}
-		delete []ctx.results;
+		// the buffer of the results is kept for the next LOD
+		ctx.results = NULL;
 		ctx.updatelist_time += logt("updating the candidate lists",start);
 
 		logt("evaluating with lod %d", iter_start, lod);
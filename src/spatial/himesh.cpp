@@ -25,6 +25,7 @@ HiMesh::HiMesh(string &str, bool completeop):
 	auto very_start = start;
 	srand(PPMC_RANDOM_CONSTANT);
 	i_mode = COMPRESSION_MODE_ID;
+	codec_flags = hausdorff_storage_setting;
 	// Create the compressed data buffer.
 	const size_t d_capacity = 3*str.size();
 	p_data = new char[d_capacity];
@@ -58,6 +59,9 @@ HiMesh::HiMesh(string &str, bool completeop):
 
 	// update the temporary data structures
 	updateMBB();
+	// snap the vertices to the quantization grid if lossy geometry is required,
+	// the snapped mesh is taken as the original one from now on
+	quantize();
 
 	if(HiMesh::calculate_method == HCT_BVHTREE){
 		updateAABB();
@@ -109,6 +113,9 @@ HiMesh::~HiMesh(){
 	   delete[] p_data;
 	}
 	clear_aabb_tree();
+	if(geometry_model){
+		delete geometry_model;
+	}
 	for(replacing_group *rg:map_group){
 		delete rg;
 	}
@@ -22,55 +22,6 @@
 
 namespace tdbase{
 
-// Write a given number of bits in a buffer.
-void writeBits(uint32_t data, unsigned i_nbBits, char *p_dest,
-               unsigned &i_bitOffset, size_t &offset)
-{
-    assert(i_nbBits <= 25);
-
-    uint32_t dataToAdd = data << (32 - i_nbBits - i_bitOffset);
-    // Swap the integer bytes because the x86 architecture is little endian.
-    dataToAdd = __builtin_bswap32(dataToAdd); // Call a GCC builtin function.
-
-    // Write the data.
-    *(uint32_t *)p_dest |= dataToAdd;
-
-    // Update the size and offset.
-    offset += (i_bitOffset + i_nbBits) / 8;
-    i_bitOffset = (i_bitOffset + i_nbBits) % 8;
-}
-
-
-/**
-  * Read a given number of bits in a buffer.
-  */
-uint32_t readBits(unsigned i_nbBits, char *p_src,
-                  unsigned &i_bitOffset, size_t &offset)
-{
-    assert(i_nbBits <= 25);
-
-    // Build the mask.
-    uint32_t mask = 0;
-    for (unsigned i = 0; i < 32 - i_bitOffset; ++i)
-        mask |= 1 << i;
-    // Swap the mask bytes because the x86 architecture is little endian.
-    mask = __builtin_bswap32(mask); // Call a GCC builtin function.
-
-    uint32_t data = *(uint32_t *)p_src & mask;
-
-    // Swap the integer bytes because the x86 architecture is little endian.
-    data = __builtin_bswap32(data); // Call a GCC builtin function.
-
-    data >>= 32 - i_nbBits - i_bitOffset;
-
-    // Update the size and offset.
-    offset += (i_bitOffset + i_nbBits) / 8;
-    i_bitOffset = (i_bitOffset + i_nbBits) % 8;
-
-    return data;
-}
-
-
 // Write a floating point number in the data buffer.
 void HiMesh::writeFloat(float f)
 {
@@ -178,4 +129,151 @@ void HiMesh::writeChar(unsigned char  i)
     dataOffset += sizeof(unsigned char );
 }
 
+/**
+  * Write an unsigned integer in 7-bit groups, the high bit
+  * of each byte tells if more bytes follow.
+  */
+void HiMesh::writeVarint(uint32_t v)
+{
+    while (v >= 0x80) {
+        writeChar((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    writeChar((unsigned char)v);
+}
+
+/**
+  * Read an unsigned integer written by writeVarint.
+  */
+uint32_t HiMesh::readVarint()
+{
+    uint32_t v = 0;
+    int shift = 0;
+    unsigned char b;
+    do {
+        b = readChar();
+        v |= (uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+/**
+  * Write a single bit in the data buffer. The bits fill each
+  * byte from the lowest one, and a run of bits must be closed
+  * with alignBits() before writing anything else.
+  */
+void HiMesh::writeBit(unsigned char bit)
+{
+    if (i_bitOffset == 0)
+        p_data[dataOffset] = 0;
+    p_data[dataOffset] |= (bit & 1) << i_bitOffset;
+    if (++i_bitOffset == 8) {
+        i_bitOffset = 0;
+        dataOffset++;
+    }
+}
+
+/**
+  * Read a single bit in the data buffer.
+  */
+unsigned char HiMesh::readBit()
+{
+    unsigned char bit = (p_data[dataOffset] >> i_bitOffset) & 1;
+    if (++i_bitOffset == 8) {
+        i_bitOffset = 0;
+        dataOffset++;
+    }
+    return bit;
+}
+
+// Skip the rest of a partially written or read byte.
+void HiMesh::alignBits()
+{
+    if (i_bitOffset != 0) {
+        i_bitOffset = 0;
+        dataOffset++;
+    }
+}
+
+/*
+ * the quantization grid has a power-of-two step and a low corner
+ * aligned to it, so every grid point is exactly representable in float
+ * and quantize() is the exact inverse of dequantize(). the step is
+ * enlarged when the requested precision is finer than what float can
+ * hold around the coordinates of the mesh.
+ * */
+void HiMesh::quantize(){
+	assert(is_compression_mode());
+	quantization_bits = min(quantization_bits_setting, (uint32_t)HIMESH_MAX_QUANTIZATION_BITS);
+	if(quantization_bits == 0){
+		return;
+	}
+	float extent = 0;
+	float maxabs = 0;
+	for(int i=0;i<3;i++){
+		extent = max(extent, mbb.high[i] - mbb.low[i]);
+		maxabs = max(maxabs, max(fabsf(mbb.low[i]), fabsf(mbb.high[i])));
+	}
+	int exp = -126;
+	if(extent > 0){
+		int e;
+		float m = frexpf(extent / ((1u<<quantization_bits) - 1), &e);
+		exp = (m == 0.5) ? e - 1 : e;
+	}
+	if(maxabs > 0){
+		int e;
+		frexpf(maxabs, &e);
+		exp = max(exp, e - 22);
+	}
+	quantization_exp = max(-126, min(exp, 127));
+	quantization_step = ldexpf(1.0, quantization_exp);
+	for(int i=0;i<3;i++){
+		quantization_low[i] = floorf(mbb.low[i] / quantization_step) * quantization_step;
+	}
+
+	// snap all the vertices to the grid
+	int32_t q[3];
+	for(Vertex_iterator vit = vertices_begin(); vit != vertices_end(); ++vit){
+		quantize(vit->point(), q);
+		vit->point() = dequantize(q);
+	}
+	updateMBB();
+}
+
+void HiMesh::quantize(const Point &p, int32_t q[3]) const{
+	for(int i=0;i<3;i++){
+		q[i] = (int32_t)lroundf((p[i] - quantization_low[i]) / quantization_step);
+	}
+}
+
+Point HiMesh::dequantize(const int32_t q[3]) const{
+	return Point(quantization_low[0] + q[0]*quantization_step,
+				 quantization_low[1] + q[1]*quantization_step,
+				 quantization_low[2] + q[2]*quantization_step);
+}
+
+/*
+ * predict the removed vertex of a face with the rounded barycenter
+ * of its quantized vertices. only integers are involved so the encoder
+ * and the decoder always agree on the prediction.
+ * */
+void HiMesh::predict(Face_handle f, int32_t pred[3]) const{
+	int64_t sum[3] = {0, 0, 0};
+	int64_t degree = 0;
+	int32_t q[3];
+	Facet_const_handle cf = f;
+	Halfedge_around_facet_const_circulator hit(cf->facet_begin()), end(hit);
+	do {
+		quantize(hit->vertex()->point(), q);
+		for(int i=0;i<3;i++){
+			sum[i] += q[i];
+		}
+		degree++;
+	} while(++hit != end);
+	for(int i=0;i<3;i++){
+		pred[i] = (int32_t)((sum[i] + degree/2) / degree);
+	}
+}
+
 }
@@ -15,6 +15,7 @@ void HiMesh::clear_aabb_tree(){
 		triangle_tree = NULL;
 	}
 	aabb_triangles.clear();
+	aabb_segments.clear();
 }
 
 TriangleTree *HiMesh::get_aabb_tree_triangle(){
@@ -24,4 +25,12 @@ TriangleTree *HiMesh::get_aabb_tree_triangle(){
 	return triangle_tree;
 }
 
+// the segments checked against the trees of other meshes
+const list<Segment> &HiMesh::get_aabb_segments(){
+	if(aabb_segments.empty()){
+		aabb_segments = get_segments();
+	}
+	return aabb_segments;
+}
+
 }
@@ -9,6 +9,8 @@
 #include <unistd.h>
 #include <cstring>
 #include "util.h"
+#include <algorithm>
+#include <numeric>
 
 using namespace std;
 
@@ -167,6 +169,99 @@ range aab::distance(const aab &b){
 	return ret;
 }
 
+void aab_soa::clear(){
+	data.clear();
+	num = 0;
+}
+
+void aab_soa::push_back(const aab &b){
+	if(num%AAB_SOA_BLOCK == 0){
+		data.resize(data.size()+6*AAB_SOA_BLOCK, 0);
+	}
+	float *blk = data.data() + (num/AAB_SOA_BLOCK)*6*AAB_SOA_BLOCK + num%AAB_SOA_BLOCK;
+	for(int i=0;i<3;i++){
+		blk[i*AAB_SOA_BLOCK] = b.low[i];
+		blk[(i+3)*AAB_SOA_BLOCK] = b.high[i];
+	}
+	num++;
+}
+
+static void aab_distance_scalar(const float *low, const float *high, const aab_soa &boxes, size_t first, size_t num, range *ret){
+	for(size_t l=0;l<num;l++){
+		float mindist = 0;
+		float maxdist = 0;
+		for(int i=0;i<3;i++){
+			float tmp1 = low[i]-boxes.get(i+3, first+l);
+			float tmp2 = high[i]-boxes.get(i, first+l);
+			maxdist += (tmp1+tmp2)*(tmp1+tmp2)/4;
+			if(tmp2<0){
+				mindist += tmp2*tmp2;
+			}else if(tmp1>0){
+				mindist += tmp1*tmp1;
+			}
+		}
+		ret[l].mindist = sqrt(mindist);
+		ret[l].maxdist = sqrt(maxdist);
+	}
+}
+
+// one block of boxes a time, with the same operations in the same order
+// as the scalar code so the results are identical
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#pragma GCC optimize("fp-contract=off")
+static void aab_distance_avx2(const float *low, const float *high, const aab_soa &boxes, size_t first, size_t num, range *ret){
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 four = _mm256_set1_ps(4.0f);
+	__m256 l[3], h[3];
+	for(int i=0;i<3;i++){
+		l[i] = _mm256_set1_ps(low[i]);
+		h[i] = _mm256_set1_ps(high[i]);
+	}
+	alignas(32) float mins[AAB_SOA_BLOCK];
+	alignas(32) float maxs[AAB_SOA_BLOCK];
+	// the boxes before the first block boundary
+	size_t b = min(num, (AAB_SOA_BLOCK-first%AAB_SOA_BLOCK)%AAB_SOA_BLOCK);
+	if(b>0){
+		aab_distance_scalar(low, high, boxes, first, b, ret);
+	}
+	// the last block is padded, only its valid lanes are returned
+	for(;b<num;b+=AAB_SOA_BLOCK){
+		const float *blk = boxes.block(first+b);
+		__m256 mindist = zero;
+		__m256 maxdist = zero;
+		for(int i=0;i<3;i++){
+			__m256 tmp1 = _mm256_sub_ps(l[i], _mm256_loadu_ps(blk+(i+3)*AAB_SOA_BLOCK));
+			__m256 tmp2 = _mm256_sub_ps(h[i], _mm256_loadu_ps(blk+i*AAB_SOA_BLOCK));
+			__m256 sum = _mm256_add_ps(tmp1, tmp2);
+			maxdist = _mm256_add_ps(maxdist, _mm256_div_ps(_mm256_mul_ps(sum, sum), four));
+			// tmp2 if it is negative, otherwise tmp1 if it is positive, or 0
+			__m256 gap = _mm256_and_ps(tmp1, _mm256_cmp_ps(tmp1, zero, _CMP_GT_OQ));
+			gap = _mm256_blendv_ps(gap, tmp2, _mm256_cmp_ps(tmp2, zero, _CMP_LT_OQ));
+			mindist = _mm256_add_ps(mindist, _mm256_mul_ps(gap, gap));
+		}
+		_mm256_store_ps(mins, _mm256_sqrt_ps(mindist));
+		_mm256_store_ps(maxs, _mm256_sqrt_ps(maxdist));
+		const size_t lanes = min((size_t)AAB_SOA_BLOCK, num-b);
+		for(size_t k=0;k<lanes;k++){
+			ret[b+k].mindist = mins[k];
+			ret[b+k].maxdist = maxs[k];
+		}
+	}
+}
+#pragma GCC pop_options
+
+void aab::distance(const aab_soa &boxes, size_t first, size_t num, range *ret){
+	assert(first+num<=boxes.size());
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	// not worth it for a few boxes, e.g. in the small octree leaves
+	if(avx2 && num>=AAB_SOA_BLOCK/2){
+		aab_distance_avx2(low, high, boxes, first, num, ret);
+	}else{
+		aab_distance_scalar(low, high, boxes, first, num, ret);
+	}
+}
+
 
 /*
  *
@@ -190,6 +285,7 @@ void Voxel::clear(){
 	}
 	capacity = 0;
 	owned = false;
+	bvh.clear();
 }
 
 // create buffer if needed
@@ -263,6 +359,92 @@ float Voxel::getProxyHausdorffDistance(int offset){
 	return *(hausdorff+offset*2);
 }
 
+void Voxel::build_bvh(){
+	bvh.build(triangles, hausdorff, num_triangles);
+}
+
+/*
+ * functions for the triangle_bvh class
+ *
+ * */
+
+void triangle_bvh::clear(){
+	nodes.clear();
+	order.clear();
+}
+
+void triangle_bvh::build(const float *triangles, const float *hausdorff, size_t num){
+	clear();
+	if(num == 0){
+		return;
+	}
+	order.resize(num);
+	std::iota(order.begin(), order.end(), 0);
+	// a binary tree with leaves of at least half full
+	nodes.reserve(2*(num+BVH_LEAF_SIZE-1)/BVH_LEAF_SIZE);
+	float *centroids = new float[3*num];
+	for(size_t t=0;t<num;t++){
+		const float *tri = triangles+9*t;
+		for(int k=0;k<3;k++){
+			centroids[3*t+k] = (tri[k]+tri[3+k]+tri[6+k])/3;
+		}
+	}
+	build_node(triangles, hausdorff, centroids, 0, num);
+	delete []centroids;
+}
+
+// the triangles are split at the median of their centroids along the longest axis
+uint32_t triangle_bvh::build_node(const float *triangles, const float *hausdorff, const float *centroids, uint32_t first, uint32_t count){
+	const uint32_t id = nodes.size();
+	nodes.push_back(bvh_node());
+	bvh_node node;
+	node.first = first;
+	node.count = count;
+	node.max_phdist = 0;
+	node.min_hdist = hausdorff ? FLT_MAX : 0;
+	float cbox[6];
+	for(int k=0;k<3;k++){
+		node.box[k] = FLT_MAX;
+		node.box[3+k] = -FLT_MAX;
+		cbox[k] = FLT_MAX;
+		cbox[3+k] = -FLT_MAX;
+	}
+	for(uint32_t i=first;i<first+count;i++){
+		const uint32_t t = order[i];
+		for(int v=0;v<3;v++){
+			for(int k=0;k<3;k++){
+				node.box[k] = min(node.box[k], triangles[9*t+3*v+k]);
+				node.box[3+k] = max(node.box[3+k], triangles[9*t+3*v+k]);
+			}
+		}
+		for(int k=0;k<3;k++){
+			cbox[k] = min(cbox[k], centroids[3*t+k]);
+			cbox[3+k] = max(cbox[3+k], centroids[3*t+k]);
+		}
+		if(hausdorff){
+			node.max_phdist = max(node.max_phdist, hausdorff[2*t]);
+			node.min_hdist = min(node.min_hdist, hausdorff[2*t+1]);
+		}
+	}
+	if(!node.is_leaf()){
+		int axis = 0;
+		for(int k=1;k<3;k++){
+			if(cbox[3+k]-cbox[k] > cbox[3+axis]-cbox[axis]){
+				axis = k;
+			}
+		}
+		const uint32_t half = count/2;
+		std::nth_element(order.begin()+first, order.begin()+first+half, order.begin()+first+count,
+				[centroids, axis](uint32_t a, uint32_t b){
+			return centroids[3*a+axis] < centroids[3*b+axis];
+		});
+		build_node(triangles, hausdorff, centroids, first, half);
+		node.right = build_node(triangles, hausdorff, centroids, first+half, count-half);
+	}
+	nodes[id] = node;
+	return id;
+}
+
 
 }
 
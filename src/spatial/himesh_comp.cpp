@@ -90,15 +90,8 @@ bool HiMesh::isRemovable(Vertex_handle v) const {
   * Start the next compression operation.
   */
 void HiMesh::startNextCompresssionOp() {
-	// 1. reset the stats
-	for(HiMesh::Vertex_iterator vit = vertices_begin(); vit!=vertices_end(); ++vit)
-		vit->resetState();
-
-	for(HiMesh::Halfedge_iterator hit = halfedges_begin(); hit!=halfedges_end(); ++hit)
-		hit->resetState();
-
-	for(HiMesh::Face_iterator fit = facets_begin(); fit!=facets_end(); ++fit)
-		fit->resetState();
+	// 1. reset the states of all the vertices, halfedges and faces
+	start_new_epoch();
 
 	i_nbRemovedVertices = 0; // Reset the number of removed vertices.
 
@@ -325,6 +318,7 @@ HiMesh::Halfedge_handle HiMesh::vertexCut(Halfedge_handle startH) {
 void HiMesh::RemovedVertexCodingStep() {
     // Resize the vectors to add the current conquest symbols.
     geometrySym.push_back(std::deque<Point>());
+    geometryResidualSym.push_back(std::deque<int32_t>());
     connectFaceSym.push_back(std::deque<unsigned>());
 
     // Add the first halfedge to the queue.
@@ -349,7 +343,17 @@ void HiMesh::RemovedVertexCodingStep() {
         // Determine the geometry symbol.
         if (sym){
             Point rmved = f->getRemovedVertexPos();
-            geometrySym[i_curDecimationId].push_back(rmved);
+            if (is_quantized()) {
+                // the face is exactly the polygon the decoder will see
+                // before inserting the vertex back, predict with it.
+                int32_t q[3], pred[3];
+                quantize(rmved, q);
+                predict(f, pred);
+                for (int i = 0; i < 3; i++)
+                    geometryResidualSym[i_curDecimationId].push_back(q[i] - pred[i]);
+            } else {
+                geometrySym[i_curDecimationId].push_back(rmved);
+            }
         	// record the removed points during compressing.
         }
 
@@ -452,12 +456,23 @@ void HiMesh::HausdorffCodingStep(){
 
 // Write the base mesh.
 void HiMesh::encodeBaseMesh() {
+    // Write the codec header.
+    writeInt(HIMESH_CODEC_MAGIC);
+    writeChar(HIMESH_CODEC_VERSION);
+    writeChar(codec_flags);
+    writeChar(quantization_bits);
+    writeChar((unsigned char)quantization_exp);
+
     // Write the bounding box min coordinate.
     for (unsigned i = 0; i < 3; ++i)
         writeFloat((float)(mbb.low[i]));
     for (unsigned i = 0; i < 3; ++i)
         writeFloat((float)(mbb.high[i]));
-    // Write the quantization step.
+    // Write the low corner of the quantization grid.
+    if (is_quantized()) {
+        for (unsigned i = 0; i < 3; ++i)
+            writeFloat(quantization_low[i]);
+    }
 
     unsigned i_nbVerticesBaseMesh = size_of_vertices();
     unsigned i_nbFacesBaseMesh = size_of_facets();
@@ -509,6 +524,23 @@ void HiMesh::encodeBaseMesh() {
     	writeFloat(globalHausdorfDistance[i].second);
     	//log("encode hausdorff: %d %f %f", i, globalHausdorfDistance[i].first, globalHausdorfDistance[i].second);
     }
+
+    // Write the entropy model shared by the geometry of all the decimation steps.
+    if (is_quantized()) {
+        uint64_t counts[256] = {0};
+        vector<uint8_t> bytes;
+        for (std::deque<int32_t> &residuals : geometryResidualSym) {
+            bytes.clear();
+            for (int32_t r : residuals)
+                append_varint(bytes, zigzag_encode(r));
+            for (uint8_t b : bytes)
+                counts[b]++;
+        }
+        if (geometry_model == NULL)
+            geometry_model = new rans_model();
+        geometry_model->build(counts);
+        dataOffset += geometry_model->serialize(p_data + dataOffset);
+    }
 }
 
 /**
@@ -522,8 +554,9 @@ void HiMesh::encodeInsertedEdges(unsigned i_operationId) {
     unsigned i_len = symbols.size();
     for (unsigned i = 0; i < i_len; ++i)
     {
-        writeChar(symbols[i]);
+        writeBit(symbols[i]);
     }
+    alignBits();
 }
 
 
@@ -533,22 +566,31 @@ void HiMesh::encodeInsertedEdges(unsigned i_operationId) {
 void HiMesh::encodeRemovedVertices(unsigned i_operationId) {
     std::deque<unsigned> &connSym = connectFaceSym[i_operationId];
     std::deque<Point> &geomSym = geometrySym[i_operationId];
+    std::deque<int32_t> &residualSym = geometryResidualSym[i_operationId];
 
-    unsigned i_lenGeom = geomSym.size();
     unsigned i_lenConn = connSym.size();
-    assert(i_lenGeom > 0);
     assert(i_lenConn > 0);
+    assert(geomSym.size() > 0 || residualSym.size() > 0);
 
-    unsigned k = 0;
+    // Encode the connectivity, one bit per face.
     for (unsigned i = 0; i < i_lenConn; ++i) {
-        // Encode the connectivity.
-        unsigned sym = connSym[i];
-        writeChar(sym);
-        // Encode the geometry if necessary.
-        if (sym) {
-            writePoint(geomSym[k]);
-            k++;
-        }
+        writeBit(connSym[i]);
+    }
+    alignBits();
+
+    // Encode the geometry of the removed vertices in the same order.
+    if (is_quantized()) {
+        vector<uint8_t> bytes;
+        for (int32_t r : residualSym)
+            append_varint(bytes, zigzag_encode(r));
+        vector<uint8_t> coded;
+        rans_encode(*geometry_model, bytes.data(), bytes.size(), coded);
+        writeVarint(coded.size());
+        memcpy(p_data + dataOffset, coded.data(), coded.size());
+        dataOffset += coded.size();
+    } else {
+        for (Point &p : geomSym)
+            writePoint(p);
     }
 }
 
@@ -557,11 +599,16 @@ void HiMesh::encodeHausdorff(unsigned i_operationId){
 	std::deque<unsigned char> &proxyhausSym = proxyhausdorfSym[i_operationId];
 	std::deque<float> &hausSym_float = hausdorfSym_float[i_operationId];
 	std::deque<float> &proxyhausSym_float = proxyhausdorfSym_float[i_operationId];
+	const uint8_t storage = get_hausdorff_storage();
 	for(int i=0;i<hausSym.size();i++){
-		writeChar(hausSym[i]);
-		writeChar(proxyhausSym[i]);
-		writeFloat(hausSym_float[i]);
-		writeFloat(proxyhausSym_float[i]);
+		if(storage & HIMESH_FLAG_HAUSDORFF_BYTE){
+			writeChar(hausSym[i]);
+			writeChar(proxyhausSym[i]);
+		}
+		if(storage & HIMESH_FLAG_HAUSDORFF_FLOAT){
+			writeFloat(hausSym_float[i]);
+			writeFloat(proxyhausSym_float[i]);
+		}
 	}
 }
 
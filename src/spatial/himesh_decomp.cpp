@@ -43,11 +43,8 @@ void HiMesh::startNextDecompresssionOp() {
 		return;
 	}
 
-	// 1. reset the states. note that the states of the vertices need not to be reset
-    for (HiMesh::Halfedge_iterator hit = halfedges_begin(); hit!=halfedges_end(); ++hit)
-        hit->resetState();
-    for (HiMesh::Face_iterator fit = facets_begin(); fit!=facets_end(); ++fit)
-        fit->resetState();
+	// 1. reset the states of all the halfedges and faces
+	start_new_epoch();
 
 	i_curDecimationId++; // increment the current decimation operation id.
 
@@ -69,6 +66,8 @@ void HiMesh::decode(int lod){
 	if(lod<i_decompPercentage){
 		return;
 	}
+	// the AABB tree and segments of the previous LOD are outdated
+	clear_aabb_tree();
 	i_decompPercentage = lod;
 	b_jobCompleted = false;
 
@@ -79,11 +78,29 @@ void HiMesh::decode(int lod){
 
 // Read the base mesh.
 void HiMesh::decodeBaseMesh() {
+    // Read the codec header, the legacy streams start with the bounding box directly.
+    if (*(uint32_t *)(p_data + dataOffset) == HIMESH_CODEC_MAGIC) {
+        dataOffset += sizeof(uint32_t);
+        codec_version = readChar();
+        codec_flags = readChar();
+        quantization_bits = readChar();
+        quantization_exp = (int8_t)readChar();
+        assert(codec_version >= 2 && codec_version <= HIMESH_CODEC_VERSION);
+    } else {
+        codec_version = 1;
+    }
+
     // Read the bounding box
     for (unsigned i = 0; i < 3; ++i)
         mbb.low[i] = readFloat();
     for (unsigned i = 0; i < 3; ++i)
         mbb.high[i] = readFloat();
+    // Read the quantization grid
+    if (is_quantized()) {
+        for (unsigned i = 0; i < 3; ++i)
+            quantization_low[i] = readFloat();
+        quantization_step = ldexpf(1.0, quantization_exp);
+    }
 
     // Read the number of level of detail.
     i_nbDecimations = readInt16();
@@ -132,11 +149,20 @@ void HiMesh::decodeBaseMesh() {
     	//log("decode hausdorff: %d %f %f",i, proxyhausdorff, hausdorff);
     }
 
+    // Read the entropy model of the quantized geometry
+    if (is_quantized()) {
+        geometry_model = new rans_model();
+        dataOffset += geometry_model->deserialize(p_data + dataOffset);
+    }
+
     // load the Hausdorff distances for the base LOD
 	HausdorffDecodingStep();
 }
 
 void HiMesh::RemovedVerticesDecodingStep(){
+	// the faces to be split, in the order their vertices are stored
+	vector<Face_handle> splittable;
+
     // Add the first halfedge to the queue.
 	pushHehInit();
 	while (!gateQueue.empty()) {
@@ -160,15 +186,47 @@ void HiMesh::RemovedVerticesDecodingStep(){
 		} while (hIt != h);
 
 		// Decode the face symbol.
-		unsigned sym = readChar();
-		if (sym == 1){
-			Point rmved = readPoint();
+		if (codec_version < 2) {
+			// legacy stream, the symbols and the positions are interleaved
+			unsigned sym = readChar();
+			if (sym == 1){
+				Point rmved = readPoint();
+				f->setSplittable();
+				f->setRemovedVertexPos(rmved);
+			} else {
+				f->setUnsplittable();
+			}
+			continue;
+		}
+		if (readBit()){
 			f->setSplittable();
-			f->setRemovedVertexPos(rmved);
+			splittable.push_back(f);
 		} else {
 			f->setUnsplittable();
 		}
 	}
+	if (codec_version < 2) {
+		return;
+	}
+	alignBits();
+
+	// Decode the geometry of the removed vertices.
+	if (is_quantized()) {
+		size_t coded_size = readVarint();
+		rans_decoder decoder(geometry_model, p_data + dataOffset);
+		int32_t q[3];
+		for (Face_handle &f : splittable) {
+			predict(f, q);
+			for (int i = 0; i < 3; i++)
+				q[i] += zigzag_decode(decode_varint(decoder));
+			f->setRemovedVertexPos(dequantize(q));
+		}
+		dataOffset += coded_size;
+	} else {
+		for (Face_handle &f : splittable) {
+			f->setRemovedVertexPos(readPoint());
+		}
+	}
 }
 
 /**
@@ -192,7 +250,7 @@ void HiMesh::InsertedEdgeDecodingStep() {
         // There is no symbol if the two faces of an edge are unsplitable.
         if (h->facet()->isSplittable() || h->opposite()->facet()->isSplittable()) {
             // Decode the edge symbol.
-            unsigned sym = readChar();
+            unsigned sym = codec_version < 2 ? readChar() : readBit();
             // Determine if the edge is original or not.
             // Mark the edge to be removed.
             if (sym != 0)
@@ -208,6 +266,9 @@ void HiMesh::InsertedEdgeDecodingStep() {
         }
         assert(!hIt->isNew());
     }
+    if (codec_version >= 2) {
+        alignBits();
+    }
 }
 
 void HiMesh::HausdorffDecodingStep(){
@@ -216,27 +277,45 @@ void HiMesh::HausdorffDecodingStep(){
 		return;
 	}
 	//log("DecimationId: %d", this->i_curDecimationId);
+	const uint8_t storage = get_hausdorff_storage();
+	const bool has_byte = storage & HIMESH_FLAG_HAUSDORFF_BYTE;
+	const bool has_float = storage & HIMESH_FLAG_HAUSDORFF_FLOAT;
 	int idx = 0;
-	for(HiMesh::Face_iterator fit = facets_begin(); fit!=facets_end(); ++fit){
-		fit->resetHausdorff();
-		unsigned char hausdorff_code = readChar();
-		unsigned char proxyhausdorff_code = readChar();
-		float hausdorff = readFloat();
-		float proxyhausdorff = readFloat();
-
-		if(use_byte_coding){
+	// the byte codes are used if asked for, or if they are the only ones stored
+	if(has_byte && (use_byte_coding || !has_float)){
+		const float max_hausdorff = getHausdorffDistance();
+		const float max_proxyhausdorff = getProxyHausdorffDistance();
+		for(HiMesh::Face_iterator fit = facets_begin(); fit!=facets_end(); ++fit){
+			unsigned char hausdorff_code = readChar();
+			unsigned char proxyhausdorff_code = readChar();
+			if(has_float){
+				// skip the raw values
+				dataOffset += 2*sizeof(float);
+			}
 			// decode the hausdorf distance symbols
-			//printf("%f %f -> ", hausdorff, proxyhausdorff);
-			hausdorff = hausdorff_code * getHausdorffDistance()/127.0;
-			proxyhausdorff = proxyhausdorff_code * getProxyHausdorffDistance()/127.0;
-			//printf("%f %f (%f %f)\n", hausdorff, proxyhausdorff, getHausdorffDistance(), getProxyHausdorffDistance());
+			float hausdorff = hausdorff_code * max_hausdorff/127.0;
+			float proxyhausdorff = proxyhausdorff_code * max_proxyhausdorff/127.0;
+			fit->setHausdorff(hausdorff);
+			fit->setProxyHausdorff(proxyhausdorff);
+			if(global_ctx.verbose>=3)
+			{
+				log("decode face %d:\t%.2f %.2f", idx++, proxyhausdorff, hausdorff);
+			}
 		}
-
-		fit->setHausdorff(hausdorff);
-		fit->setProxyHausdorff(proxyhausdorff);
-		if(global_ctx.verbose>=3)
-		{
-			log("decode face %d:\t%.2f %.2f", idx++, proxyhausdorff, hausdorff);
+	}else{
+		for(HiMesh::Face_iterator fit = facets_begin(); fit!=facets_end(); ++fit){
+			if(has_byte){
+				// skip the byte codes
+				dataOffset += 2*sizeof(unsigned char);
+			}
+			float hausdorff = readFloat();
+			float proxyhausdorff = readFloat();
+			fit->setHausdorff(hausdorff);
+			fit->setProxyHausdorff(proxyhausdorff);
+			if(global_ctx.verbose>=3)
+			{
+				log("decode face %d:\t%.2f %.2f", idx++, proxyhausdorff, hausdorff);
+			}
 		}
 	}
 }
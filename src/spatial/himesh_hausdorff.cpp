@@ -55,6 +55,8 @@ pair<float, float> HiMesh::collectGlobalHausdorff(STAT_TYPE type){
 uint32_t HiMesh::sampling_rate = 30;
 Hausdorff_Computing_Type HiMesh::calculate_method = HCT_BVHTREE;
 bool HiMesh::use_byte_coding = true;
+uint32_t HiMesh::quantization_bits_setting = 0;
+uint8_t HiMesh::hausdorff_storage_setting = HIMESH_FLAG_HAUSDORFF_BYTE;
 
 void sample_points_triangle(const Triangle &tri, unordered_set<Point> &points, int num_points){
 	const Point &p1 = tri[0];
@@ -54,9 +54,9 @@ float HiMesh::distance(HiMesh *target){
 }
 
 bool HiMesh::intersect_tree(HiMesh *target){
-	list<Segment> segments = get_segments();
+	const list<Segment> &segments = get_aabb_segments();
 	assert(segments.size()>0);
-    for(Segment &s:segments){
+    for(const Segment &s:segments){
     	if(target->get_aabb_tree_triangle()->do_intersect(s)){
     		return true;
     	}
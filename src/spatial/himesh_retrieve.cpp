@@ -158,62 +158,76 @@ size_t HiMesh::fill_hausdorf_distances(float *&hausdorf){
 size_t HiMesh::fill_voxels(vector<Voxel *> &voxels){
 	assert(voxels.size()>0);
 
-	size_t num_of_element = size_of_triangles();
-	float *triangle_buffer = NULL;
-	float *hausdorf_buffer = NULL;
-	fill_triangles(triangle_buffer);
-	fill_hausdorf_distances(hausdorf_buffer);
-
-	// for the special case only one voxel exist
-	if(voxels.size()==1){
-		voxels[0]->batch_load(triangle_buffer, hausdorf_buffer, num_of_element);
-		delete []triangle_buffer;
-		delete []hausdorf_buffer;
-		return num_of_element;
-	}
-
-	// now reorganize the data with the voxel information given
-	// assign each triangle to a proper group
-	// we tried voronoi graph, but it's even slower than the brute force method
-	int *groups = new int[num_of_element];
-	int *group_count = new int[voxels.size()];
-	for(int i=0;i<voxels.size();i++){
-		group_count[i] = 0;
+	// the triangles of a facet are fanned out from the vertex of its halfedge,
+	// and each triangle is assigned to the voxel with the closest core to its first point.
+	// thus the whole facet goes to the voxel of that vertex, which is computed once
+	// for each vertex and kept along the decoding, as the vertices never move
+	if(assigned_voxels != (const void *)voxels.data()){
+		for(Vertex_iterator vit = vertices_begin(); vit != vertices_end(); ++vit){
+			vit->setVoxelId(-1);
+		}
+		assigned_voxels = (const void *)voxels.data();
 	}
-	for(int i=0;i<num_of_element;i++){
-		// for both segment and triangle, we assign it with only the first point
-		float *p1 = triangle_buffer+i*9;
-		float min_dist = DBL_MAX;
-		int gid = -1;
-		for(int j=0;j<voxels.size();j++){
-			float cur_dist = 0;
-			for(int t=0;t<3;t++){
-				cur_dist += (p1[t]-voxels[j]->core[t])*(p1[t]-voxels[j]->core[t]);
-			}
-			if(cur_dist<min_dist){
-				gid = j;
-				min_dist = cur_dist;
+	auto assign = [&](Vertex_handle vh){
+		if(voxels.size()==1){
+			return 0;
+		}
+		if(vh->getVoxelId()<0){
+			const Point &p = vh->point();
+			float min_dist = DBL_MAX;
+			int gid = -1;
+			// we tried voronoi graph, but it's even slower than the brute force method
+			for(int j=0;j<voxels.size();j++){
+				float cur_dist = 0;
+				for(int t=0;t<3;t++){
+					cur_dist += (p[t]-voxels[j]->core[t])*(p[t]-voxels[j]->core[t]);
+				}
+				if(cur_dist<min_dist){
+					gid = j;
+					min_dist = cur_dist;
+				}
 			}
+			vh->setVoxelId(gid);
 		}
-		groups[i] = gid;
-		group_count[gid]++;
-	}
+		return vh->getVoxelId();
+	};
 
 	// reserve enough space for holding the assigned triangles
+	vector<size_t> group_count(voxels.size(), 0);
+	size_t num_of_element = 0;
+	for(Facet_iterator f = facets_begin(); f != facets_end(); ++f){
+		group_count[assign(f->halfedge()->vertex())] += f->facet_degree()-2;
+		num_of_element += f->facet_degree()-2;
+	}
 	for(int i=0;i<voxels.size();i++){
 		voxels[i]->reserve(group_count[i]);
 	}
 
-	// copy the data to the proper position in the buffers
-	for(int i=0;i<num_of_element;i++){
-		voxels[groups[i]]->insert(triangle_buffer+i*9, hausdorf_buffer+i*2);
+	// write the triangles directly into the buffers of the voxels
+	for(Facet_iterator f = facets_begin(); f != facets_end(); ++f){
+		Voxel *v = voxels[assign(f->halfedge()->vertex())];
+		const float proxy_hausdorff = f->getProxyHausdorff();
+		const float hausdorff = f->getHausdorff();
+		Halfedge_const_handle e1 = f->halfedge();
+		Halfedge_const_handle e2 = e1->next();
+		const Point &p1 = e1->vertex()->point();
+		do{
+			assert(v->num_triangles < v->capacity);
+			const Point &p2 = e2->vertex()->point();
+			const Point &p3 = e2->next()->vertex()->point();
+			float *cur_S = v->triangles + v->num_triangles*9;
+			for(int i=0;i<3;i++){
+				cur_S[i] = p1[i];
+				cur_S[i+3] = p2[i];
+				cur_S[i+6] = p3[i];
+			}
+			float *cur_H = v->hausdorff + v->num_triangles*2;
+			cur_H[0] = proxy_hausdorff;
+			cur_H[1] = hausdorff;
+			v->num_triangles++;
+			e2 = e2->next();
+		}while(e1!=e2->next());
 	}
-
-	// clean the buffer
-	delete []groups;
-	delete []group_count;
-	delete []triangle_buffer;
-	delete []hausdorf_buffer;
 	return num_of_element;
 }
 
@@ -26,9 +26,8 @@ HiMesh_Wrapper::HiMesh_Wrapper(char *dt, size_t i, Decoding_Type t){
 	size_t vnum = *(size_t *)meta_buffer;
 	meta_size = sizeof(vnum);
 	if(type == COMPRESSED){
-		// the mesh reuses the memory space stored in the Tile class
-		mesh = new HiMesh(data_buffer, data_size, false);
-
+		// the mesh is created lazily when it is first decoded,
+		// only the voxels are loaded here
 		for(int i=0;i<vnum;i++){
 			Voxel *v = new Voxel();
 			memcpy(v->low, meta_buffer+meta_size, 3*sizeof(float));
@@ -74,6 +73,7 @@ HiMesh_Wrapper::HiMesh_Wrapper(char *dt, size_t i, Decoding_Type t){
 			box.update(*v);
 		}
 	}
+	voxel_boxes.assign(voxels);
 	pthread_mutex_init(&lock, NULL);
 }
 
@@ -89,6 +89,8 @@ HiMesh_Wrapper::HiMesh_Wrapper(map<int, HiMesh *> &ms){
 	for(Voxel *v:voxels){
 		box.update(*v);
 	}
+	voxel_boxes.assign(voxels);
+	pthread_mutex_init(&lock, NULL);
 
 }
 
@@ -96,7 +98,12 @@ HiMesh_Wrapper::HiMesh_Wrapper(HiMesh *m){
 	type = COMPRESSED;
 	mesh = m;
 	voxels = m->generate_voxels_skeleton();
+	for(Voxel *v:voxels){
+		box.update(*v);
+	}
+	voxel_boxes.assign(voxels);
 	m->encode();
+	pthread_mutex_init(&lock, NULL);
 }
 
 HiMesh_Wrapper::~HiMesh_Wrapper(){
@@ -115,21 +122,42 @@ HiMesh_Wrapper::~HiMesh_Wrapper(){
 }
 
 void HiMesh_Wrapper::decode_to(int lod){
+	// the same object can be decoded by multiple threads,
+	// only the first one really does the decoding job
+	pthread_mutex_lock(&lock);
 	if(lod <= cur_lod){
+		pthread_mutex_unlock(&lock);
 		return;
 	}
-	for(Voxel *v:voxels){
-		v->clear();
-	}
+	// the buffers of the voxels are reused across LODs
 	cur_lod = lod;
 
 	if(type == MULTIMESH){
 		assert(meshes.find(cur_lod)!=meshes.end());
 		get_mesh()->fill_voxels(voxels);
 	}else if(type == COMPRESSED){
-		assert(mesh);
-		mesh->decode(lod);
-		mesh->fill_voxels(voxels);
+		mesh_cache *cache = global_ctx.cache;
+		cache_key key(tile_key, id, lod);
+		float hausdorff = 0;
+		float proxyhausdorff = 0;
+		// the AABB trees are built from the mesh, and a mesh decoded already
+		// is kept at the LOD of the voxels (mesh_lod), so the voxels are
+		// filled from the mesh then. the LODs skipped by the cache hits are
+		// decoded by decode_mesh() once the mesh is needed
+		const bool need_mesh = global_ctx.use_aabb || mesh != NULL;
+		if(cache == NULL || need_mesh || !cache->fetch(key, voxels, hausdorff, proxyhausdorff)){
+			// decoded to the current LOD
+			decode_mesh();
+			mesh->fill_voxels(voxels);
+			hausdorff = mesh->getHausdorffDistance();
+			proxyhausdorff = mesh->getProxyHausdorffDistance();
+			// the AABB path never reads the cached voxels
+			if(cache && !global_ctx.use_aabb){
+				cache->store(key, voxels, hausdorff, proxyhausdorff);
+			}
+		}
+		hausdorffs[lod] = hausdorff;
+		proxyhausdorffs[lod] = proxyhausdorff;
 	}else{
 		// for RAW data mode, simply link pointers instead of do the decoding job
 		// as data already been stored a
@@ -139,25 +167,47 @@ void HiMesh_Wrapper::decode_to(int lod){
 			voxels[i]->external_load((float *)(data_buffer+offset), (float *)(data_buffer+offset+9*size*sizeof(float)), size);
 		}
 	}
+	if(global_ctx.use_bvh){
+		for(Voxel *v:voxels){
+			v->build_bvh();
+		}
+	}
 	if(global_ctx.verbose>=3){
 		for(int i=0;i<voxels.size();i++){
 			printf("decode_to: id: %ld\t voxel_id: %d\t lod: %d\t offset: %ld\t volume: %ld\n", id, i, lod, voxels[i]->offset_lod[lod], voxels[i]->volume_lod[lod]);
 			voxels[i]->print();
 		}
 	}
+	pthread_mutex_unlock(&lock);
+}
+
+void HiMesh_Wrapper::load_mesh(){
+	assert(type == COMPRESSED && data_buffer);
+	// the mesh reuses the memory space stored in the Tile class
+	mesh = new HiMesh(data_buffer, data_size, false);
+}
+
+void HiMesh_Wrapper::decode_mesh(){
+	if(mesh == NULL){
+		load_mesh();
+	}
+	if(cur_lod > mesh_lod){
+		mesh->decode(cur_lod);
+		mesh_lod = cur_lod;
+	}
 }
 
 float HiMesh_Wrapper::getHausdorffDistance(){
-	if(type == COMPRESSED){
-		return mesh->getHausdorffDistance();
+	if(type == COMPRESSED && cur_lod < 0){
+		return get_mesh()->getHausdorffDistance();
 	}else{
 		assert(hausdorffs.find(cur_lod)!=hausdorffs.end());
 		return hausdorffs[cur_lod];
 	}
 }
 float HiMesh_Wrapper::getProxyHausdorffDistance(){
-	if(type == COMPRESSED){
-		return mesh->getProxyHausdorffDistance();
+	if(type == COMPRESSED && cur_lod < 0){
+		return get_mesh()->getProxyHausdorffDistance();
 	}else{
 		assert(hausdorffs.find(cur_lod)!=hausdorffs.end());
 		return proxyhausdorffs[cur_lod];
@@ -5,6 +5,94 @@
  *      Author: teng
  */
 
+#include "cache.h"
 
+namespace tdbase{
 
+mesh_cache::~mesh_cache(){
+	for(auto &e:lru){
+		delete e.second;
+	}
+	lru.clear();
+	index.clear();
+	pthread_mutex_destroy(&lock);
+}
 
+bool mesh_cache::fetch(const cache_key &key, vector<Voxel *> &voxels, float &hausdorff, float &proxyhausdorff){
+	pthread_mutex_lock(&lock);
+	auto it = index.find(key);
+	if(it == index.end()){
+		misses++;
+		pthread_mutex_unlock(&lock);
+		return false;
+	}
+	hits++;
+	// move to the head of the LRU list
+	lru.splice(lru.begin(), lru, it->second);
+	cached_lod *entry = it->second->second;
+	assert(entry->sizes.size() == voxels.size());
+	for(size_t i=0;i<voxels.size();i++){
+		voxels[i]->batch_load(entry->triangles + entry->offsets[i]*9, entry->hausdorff + entry->offsets[i]*2, entry->sizes[i]);
+	}
+	hausdorff = entry->hausdorff_dist;
+	proxyhausdorff = entry->proxy_hausdorff_dist;
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+void mesh_cache::store(const cache_key &key, vector<Voxel *> &voxels, float hausdorff, float proxyhausdorff){
+	size_t num_triangles = 0;
+	for(Voxel *v:voxels){
+		num_triangles += v->num_triangles;
+	}
+	size_t bytes = sizeof(cached_lod) + num_triangles*11*sizeof(float) + voxels.size()*2*sizeof(size_t);
+	if(bytes > capacity){
+		return;
+	}
+
+	// prepare the entry out of the lock
+	cached_lod *entry = new cached_lod();
+	entry->triangles = new float[num_triangles*9];
+	entry->hausdorff = new float[num_triangles*2];
+	entry->hausdorff_dist = hausdorff;
+	entry->proxy_hausdorff_dist = proxyhausdorff;
+	entry->bytes = bytes;
+	size_t offset = 0;
+	for(Voxel *v:voxels){
+		entry->offsets.push_back(offset);
+		entry->sizes.push_back(v->num_triangles);
+		memcpy(entry->triangles + offset*9, v->triangles, v->num_triangles*9*sizeof(float));
+		memcpy(entry->hausdorff + offset*2, v->hausdorff, v->num_triangles*2*sizeof(float));
+		offset += v->num_triangles;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(index.find(key) != index.end()){
+		// cached by another thread
+		pthread_mutex_unlock(&lock);
+		delete entry;
+		return;
+	}
+	// evict the least recently used ones
+	while(used + bytes > capacity && !lru.empty()){
+		auto &victim = lru.back();
+		used -= victim.second->bytes;
+		index.erase(victim.first);
+		delete victim.second;
+		lru.pop_back();
+		evictions++;
+	}
+	lru.push_front(pair<cache_key, cached_lod *>(key, entry));
+	index[key] = lru.begin();
+	used += bytes;
+	pthread_mutex_unlock(&lock);
+}
+
+void mesh_cache::print(){
+	pthread_mutex_lock(&lock);
+	fprintf(stderr, "cache:\t%ld hits\t%ld misses\t%ld evictions\t%ld/%ld bytes\t%ld entries\n",
+			hits, misses, evictions, used, capacity, lru.size());
+	pthread_mutex_unlock(&lock);
+}
+
+}
@@ -10,23 +10,85 @@
 
 #include <pthread.h>
 #include <vector>
+#include <list>
+#include <unordered_map>
 #include "../include/util.h"
+#include "../include/aab.h"
 
 using namespace std;
 
 namespace tdbase{
 
+// identify one object at one LOD
+typedef struct cache_key{
+	size_t tile = 0;
+	size_t id = 0;
+	int lod = 0;
+	cache_key(size_t t, size_t i, int l){
+		tile = t;
+		id = i;
+		lod = l;
+	}
+	bool operator==(const cache_key &k) const{
+		return tile == k.tile && id == k.id && lod == k.lod;
+	}
+}cache_key;
+
+struct cache_key_hash{
+	size_t operator()(const cache_key &k) const{
+		size_t h = k.tile;
+		h ^= k.id + 0x9e3779b97f4a7c15 + (h<<6) + (h>>2);
+		h ^= (size_t)k.lod + 0x9e3779b97f4a7c15 + (h<<6) + (h>>2);
+		return h;
+	}
+};
+
+/*
+ * the decoded triangles and hausdorff distances of all
+ * the voxels of one object at one LOD, stored voxel by voxel
+ * */
+class cached_lod{
+public:
+	float *triangles = NULL;
+	float *hausdorff = NULL;
+	vector<size_t> offsets;
+	vector<size_t> sizes;
+	float hausdorff_dist = 0;
+	float proxy_hausdorff_dist = 0;
+	size_t bytes = 0;
+	~cached_lod(){
+		delete []triangles;
+		delete []hausdorff;
+	}
+};
 
+/*
+ * a LRU cache of the decoded LODs, bounded by the
+ * number of bytes it holds. The buffers are copied
+ * in and out of the cache, such that the voxels never
+ * refer to the space of an evicted entry
+ * */
 class mesh_cache{
 	const size_t capacity;
+	size_t used = 0;
 	pthread_mutex_t lock;
+	list<pair<cache_key, cached_lod *>> lru;
+	unordered_map<cache_key, list<pair<cache_key, cached_lod *>>::iterator, cache_key_hash> index;
 public:
-	mesh_cache(size_t c){
-		capacity = c;
+	// statistics
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;
+public:
+	mesh_cache(size_t c):capacity(c){
 		pthread_mutex_init(&lock, NULL);
 	}
-
-
+	~mesh_cache();
+	// fill the voxels with the cached LOD, return false if missed
+	bool fetch(const cache_key &key, vector<Voxel *> &voxels, float &hausdorff, float &proxyhausdorff);
+	// put a copy of the decoded voxels into the cache
+	void store(const cache_key &key, vector<Voxel *> &voxels, float hausdorff, float proxyhausdorff);
+	void print();
 };
 
 }
@@ -21,12 +21,15 @@ namespace tdbase{
 Tile::Tile(std::string path, size_t capacity, bool active_load){
 	tile_path = path;
 	tile_capacity = capacity;
+	tile_key = std::hash<string>()(path);
+	pthread_mutex_init(&lock, NULL);
 	if(active_load){
 		load();
 	}
 }
 
 Tile::Tile(std::vector<HiMesh_Wrapper *> &objs){
+	pthread_mutex_init(&lock, NULL);
 	objects.assign(objs.begin(), objs.end());
 	for(HiMesh_Wrapper *wr:objs){
 		if(wr->type == MULTIMESH){
@@ -55,22 +58,82 @@ Tile::~Tile(){
 	for(HiMesh_Wrapper *h:objects){
 		delete h;
 	}
-	if(data_buffer!=NULL){
-		delete []data_buffer;
+	release_buffer();
+	for(char *buf:object_buffers){
+		delete []buf;
 	}
+	object_buffers.clear();
+#if __linux
+	if(tile_fd >= 0){
+		close(tile_fd);
+	}
+#endif
 	if(tree){
 		delete tree;
 	}
+	if(str_tree){
+		delete str_tree;
+	}
+	if(voxel_tree){
+		delete voxel_tree;
+	}
 }
 
 HiMesh *Tile::get_mesh(int id){
-	return objects[id]->get_mesh();
+	return get_mesh_wrapper(id)->get_mesh();
 }
 
 void Tile::decode_all(int lod){
-	for(HiMesh_Wrapper *w:objects){
-		w->decode_to(lod);
+	for(int i=0;i<objects.size();i++){
+		get_mesh_wrapper(i)->decode_to(lod);
+	}
+}
+
+ObjectIndex *Tile::get_index(){
+	if(global_ctx.index != "str"){
+		return tree;
+	}
+	pthread_mutex_lock(&lock);
+	if(str_tree == NULL){
+		struct timeval start = get_cur_time();
+		vector<weighted_aab *> boxes;
+		boxes.reserve(objects.size());
+		for(HiMesh_Wrapper *w:objects){
+			assert(w && "the objects must be loaded");
+			boxes.push_back(&w->box);
+		}
+		str_tree = new STRTree(boxes);
+		logt("built STR tree with %ld nodes for %ld objects", start, str_tree->num_nodes(), boxes.size());
+	}
+	pthread_mutex_unlock(&lock);
+	return str_tree;
+}
+
+STRTree *Tile::get_voxel_index(){
+	// load the objects first, which takes the lock
+	for(int i=0;i<objects.size();i++){
+		get_mesh_wrapper(i);
+	}
+	pthread_mutex_lock(&lock);
+	if(voxel_tree == NULL){
+		struct timeval start = get_cur_time();
+		for(int i=0;i<objects.size();i++){
+			for(Voxel *v:objects[i]->voxels){
+				indexed_voxels.push_back(pair<int, Voxel *>(i, v));
+			}
+		}
+		voxel_boxes.resize(indexed_voxels.size());
+		vector<weighted_aab *> boxes(indexed_voxels.size());
+		for(int i=0;i<indexed_voxels.size();i++){
+			voxel_boxes[i].set_box(*indexed_voxels[i].second);
+			voxel_boxes[i].id = i;
+			boxes[i] = &voxel_boxes[i];
+		}
+		voxel_tree = new STRTree(boxes);
+		logt("built voxel index with %ld nodes for %ld voxels", start, voxel_tree->num_nodes(), boxes.size());
 	}
+	pthread_mutex_unlock(&lock);
+	return voxel_tree;
 }
 
 OctreeNode *Tile::build_octree(size_t leaf_size){
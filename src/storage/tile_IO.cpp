@@ -7,17 +7,15 @@
 
 #include "tile.h"
 
+#if __linux
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
 namespace tdbase{
 
-// do the initialization job
-void Tile::load(){
-	struct timeval start = get_cur_time();
-	if(!file_exist(tile_path.c_str())){
-		log("%s does not exist", tile_path.c_str());
-		exit(-1);
-	}
-	// load the raw data into the buffer
-	data_size = file_size(tile_path.c_str());
+// read the whole tile file into a private buffer
+void Tile::read_buffer(){
 	data_buffer = new char[data_size];
 	//process_lock();
 	FILE *dt_fs = fopen(tile_path.c_str(), "r");
@@ -29,35 +27,340 @@ void Tile::load(){
 	}
 	fclose(dt_fs);
 	//process_unlock();
+}
+
+// map the tile file into the address space, the pages are
+// faulted in on demand and shared with the page cache, the
+// compressed meshes then point straight into the mapping
+void Tile::map_buffer(){
+#if __linux
+	int fd = ::open(tile_path.c_str(), O_RDONLY);
+	if(fd < 0){
+		log("failed to open file %s",tile_path.c_str());
+		exit(-1);
+	}
+	void *addr = mmap(NULL, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED){
+		log("failed to map file %s, fall back to reading", tile_path.c_str());
+		read_buffer();
+		return;
+	}
+	data_buffer = (char *)addr;
+	mapped = true;
+	// the meta data is parsed from the beginning to the end
+	madvise(data_buffer, data_size, MADV_SEQUENTIAL);
+#else
+	read_buffer();
+#endif
+}
+
+void Tile::release_buffer(){
+	if(data_buffer == NULL){
+		return;
+	}
+#if __linux
+	if(mapped){
+		munmap(data_buffer, data_size);
+		data_buffer = NULL;
+		mapped = false;
+		return;
+	}
+#endif
+	delete []data_buffer;
+	data_buffer = NULL;
+}
+
+// read a piece of the tile file at the given offset
+bool Tile::read_at(char *buffer, size_t length, size_t offset){
+#if __linux
+	if(tile_fd < 0){
+		tile_fd = ::open(tile_path.c_str(), O_RDONLY);
+		if(tile_fd < 0){
+			return false;
+		}
+	}
+	size_t done = 0;
+	while(done < length){
+		ssize_t r = pread(tile_fd, buffer + done, length - done, offset + done);
+		if(r <= 0){
+			return false;
+		}
+		done += r;
+	}
+	return true;
+#else
+	FILE *dt_fs = fopen(tile_path.c_str(), "rb");
+	if(dt_fs == NULL){
+		return false;
+	}
+	bool succeed = fseek(dt_fs, offset, SEEK_SET) == 0 && fread(buffer, sizeof(char), length, dt_fs) == length;
+	fclose(dt_fs);
+	return succeed;
+#endif
+}
+
+// check whether the file ends with a valid trailer,
+// legacy files are parsed sequentially otherwise
+bool Tile::parse_trailer(const char *tr){
+	if(data_size < 1 + sizeof(tile_trailer)){
+		return false;
+	}
+	tile_trailer trailer;
+	memcpy((char *)&trailer, tr, sizeof(tile_trailer));
+	if(trailer.magic != TILE_FORMAT_MAGIC
+			|| trailer.version < 2 || trailer.version > TILE_FORMAT_VERSION
+			|| trailer.footer_offset < 1 || trailer.footer_offset > data_size - sizeof(tile_trailer)){
+		return false;
+	}
+	version = trailer.version;
+	return true;
+}
+
+// the footer is checked against its length and the file layout,
+// a tile with a valid trailer but a broken footer is not loaded
+void Tile::parse_footer(const char *footer, size_t length, size_t footer_offset){
+	const size_t entry_size = 2*sizeof(size_t) + 6*sizeof(float);
+	if(length < sizeof(size_t) + 6*sizeof(float)){
+		log("the footer of %s is truncated", tile_path.c_str());
+		exit(-1);
+	}
+	size_t offset = 0;
+	size_t num;
+	memcpy(&num, footer + offset, sizeof(size_t));
+	offset += sizeof(size_t);
+	if(num > (length - sizeof(size_t) - 6*sizeof(float))/entry_size){
+		log("the footer of %s is too short for %ld objects", tile_path.c_str(), num);
+		exit(-1);
+	}
+
+	entries.resize(num);
+	for(size_t i=0;i<num;i++){
+		entries[i].offset = *(size_t *)(footer + offset);
+		offset += sizeof(size_t);
+		entries[i].length = *(size_t *)(footer + offset);
+		offset += sizeof(size_t);
+		memcpy(entries[i].box.low, footer + offset, 3*sizeof(float));
+		offset += 3*sizeof(float);
+		memcpy(entries[i].box.high, footer + offset, 3*sizeof(float));
+		offset += 3*sizeof(float);
+		// the records lie between the type byte and the footer
+		if(entries[i].offset < 1 || entries[i].offset > footer_offset
+				|| entries[i].length > footer_offset - entries[i].offset){
+			log("object %ld of %s is out of the file (%ld, %ld)", i, tile_path.c_str(), entries[i].offset, entries[i].length);
+			exit(-1);
+		}
+	}
+	memcpy(space.low, footer + offset, 3*sizeof(float));
+	offset += 3*sizeof(float);
+	memcpy(space.high, footer + offset, 3*sizeof(float));
+	offset += 3*sizeof(float);
+
+	if(version >= 3){
+		if(length - offset < sizeof(size_t)){
+			log("the footer of %s misses the octree", tile_path.c_str());
+			exit(-1);
+		}
+		memcpy(&octree_length, footer + offset, sizeof(size_t));
+		offset += sizeof(size_t);
+		octree_offset = footer_offset + offset;
+		if(octree_length > length - offset){
+			log("the octree of %s is truncated", tile_path.c_str());
+			exit(-1);
+		}
+	}
+
+	// objects are created when they are loaded or fetched
+	objects.resize(num, NULL);
+}
+
+// read the footer only, such that each object can be
+// fetched with a single read afterwards
+void Tile::open(){
+	if(version > 1 || objects.size() > 0){
+		// opened or loaded already
+		return;
+	}
+	struct timeval start = get_cur_time();
+	if(!file_exist(tile_path.c_str())){
+		log("%s does not exist", tile_path.c_str());
+		exit(-1);
+	}
+	data_size = file_size(tile_path.c_str());
+
+	tile_trailer trailer;
+	char type;
+	if(data_size > 1 + sizeof(tile_trailer)
+			&& read_at(&type, 1, 0)
+			&& read_at((char *)&trailer, sizeof(tile_trailer), data_size - sizeof(tile_trailer))
+			&& parse_trailer((char *)&trailer)){
+		dtype = (Decoding_Type)type;
+		size_t footer_offset = trailer.footer_offset;
+		size_t footer_length = data_size - sizeof(tile_trailer) - footer_offset;
+		char *footer = new char[footer_length];
+		if(!read_at(footer, footer_length, footer_offset)){
+			log("failed reading the footer of %s", tile_path.c_str());
+			exit(-1);
+		}
+		parse_footer(footer, footer_length, footer_offset);
+		delete []footer;
+		logt("opened tile %s with %ld polyhedra", start, tile_path.c_str(), objects.size());
+	}else{
+		// legacy tile, parse the objects one by one
+		load();
+	}
+}
+
+// fetch one single object from the file
+HiMesh_Wrapper *Tile::load_object(int id){
+	pthread_mutex_lock(&lock);
+	HiMesh_Wrapper *wrapper = objects[id];
+	if(wrapper == NULL){
+		assert(id < entries.size() && "the tile is not opened");
+		char *buffer = NULL;
+		if(data_buffer != NULL){
+			buffer = data_buffer + entries[id].offset;
+		}else{
+			buffer = new char[entries[id].length];
+			if(!read_at(buffer, entries[id].length, entries[id].offset)){
+				log("failed reading object %d from %s", id, tile_path.c_str());
+				exit(-1);
+			}
+			object_buffers.push_back(buffer);
+		}
+		wrapper = new HiMesh_Wrapper(buffer, id, dtype);
+		wrapper->tile_key = tile_key;
+		// readers check the slot without the lock
+		__atomic_store_n(&objects[id], wrapper, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lock);
+	return wrapper;
+}
+
+// do the initialization job
+void Tile::load(){
+	struct timeval start = get_cur_time();
+	if(data_buffer != NULL){
+		// loaded already
+		return;
+	}
+	if(!file_exist(tile_path.c_str())){
+		log("%s does not exist", tile_path.c_str());
+		exit(-1);
+	}
+	// load the raw data into the buffer
+	data_size = file_size(tile_path.c_str());
+	if(global_ctx.use_mmap){
+		map_buffer();
+	}else{
+		read_buffer();
+	}
 
 	// parsing the metadata from the dt file
-	Decoding_Type dtype = (Decoding_Type)data_buffer[0];
-	size_t offset = 1;// the first byte is the file type, raw or compressed
-	size_t index = 0;
-	while(offset < data_size){
-		// create a wrapper with the meta information
-		HiMesh_Wrapper * w = new HiMesh_Wrapper(data_buffer + offset, index++, dtype);
-		offset += w->data_size + w->meta_size + sizeof(size_t);
-		objects.push_back(w);
-		space.update(w->box);
-	}
-
-	tree = build_octree(10);
+	dtype = (Decoding_Type)data_buffer[0];
+	if(data_size > 1 + sizeof(tile_trailer) && parse_trailer(data_buffer + data_size - sizeof(tile_trailer))){
+		// versioned tile, locate the objects with the footer
+		size_t footer_offset = ((tile_trailer *)(data_buffer + data_size - sizeof(tile_trailer)))->footer_offset;
+		parse_footer(data_buffer + footer_offset, data_size - sizeof(tile_trailer) - footer_offset, footer_offset);
+		for(size_t i=0;i<objects.size();i++){
+			if(objects[i] == NULL){
+				objects[i] = new HiMesh_Wrapper(data_buffer + entries[i].offset, i, dtype);
+				objects[i]->tile_key = tile_key;
+			}
+		}
+	}else{
+		size_t offset = 1;// the first byte is the file type, raw or compressed
+		size_t index = 0;
+		while(offset < data_size){
+			// create a wrapper with the meta information
+			HiMesh_Wrapper * w = new HiMesh_Wrapper(data_buffer + offset, index++, dtype);
+			w->tile_key = tile_key;
+			offset += w->data_size + w->meta_size + sizeof(size_t);
+			objects.push_back(w);
+			space.update(w->box);
+		}
+	}
+#if __linux
+	// the objects are accessed in the order of the query afterwards
+	if(mapped){
+		madvise(data_buffer, data_size, MADV_RANDOM);
+	}
+#endif
+
+	if(octree_length > 0){
+		// restore the persisted octree
+		vector<weighted_aab *> boxes;
+		boxes.reserve(objects.size());
+		for(HiMesh_Wrapper *w:objects){
+			boxes.push_back(&w->box);
+		}
+		size_t offset = 0;
+		tree = OctreeNode::deserialize(data_buffer + octree_offset, offset, boxes);
+		if(offset != octree_length){
+			log("the octree of %s is corrupted", tile_path.c_str());
+			exit(-1);
+		}
+	}else{
+		tree = build_octree(OCTREE_LEAF_SIZE);
+	}
 	logt("loaded %ld polyhedra in tile %s", start, objects.size(), tile_path.c_str());
 }
 
+// write the footer and the trailer after the object records
+size_t Tile::dump_footer(ofstream *os, size_t footer_offset){
+	size_t size = entries.size();
+	os->write((char *)&size, sizeof(size_t));
+	for(object_entry &e:entries){
+		os->write((char *)&e.offset, sizeof(size_t));
+		os->write((char *)&e.length, sizeof(size_t));
+		os->write((char *)e.box.low, 3*sizeof(float));
+		os->write((char *)e.box.high, 3*sizeof(float));
+	}
+	os->write((char *)space.low, 3*sizeof(float));
+	os->write((char *)space.high, 3*sizeof(float));
+
+	// persist the octree, in which the objects are
+	// referred to with their order in the file
+	vector<weighted_aab> boxes(entries.size());
+	OctreeNode *octree = new OctreeNode(space, 0, OCTREE_LEAF_SIZE);
+	for(size_t i=0;i<entries.size();i++){
+		boxes[i].set_box(entries[i].box);
+		boxes[i].id = i;
+		octree->addObject(&boxes[i]);
+	}
+	vector<char> flattened;
+	octree->serialize(flattened);
+	delete octree;
+	size = flattened.size();
+	os->write((char *)&size, sizeof(size_t));
+	os->write(flattened.data(), flattened.size());
+
+	tile_trailer trailer;
+	trailer.footer_offset = footer_offset;
+	os->write((char *)&trailer, sizeof(tile_trailer));
+	return sizeof(size_t) + entries.size()*(2*sizeof(size_t)+6*sizeof(float)) + 6*sizeof(float)
+			+ sizeof(size_t) + flattened.size() + sizeof(tile_trailer);
+}
+
 void Tile::dump_compressed(const char *path){
 	ofstream *os = new std::ofstream(path, std::ios::out | std::ios::binary);
 	assert(os);
 	char type = (char)COMPRESSED;
 	os->write(&type, 1);
+	size_t offset = 1;
+	entries.clear();
+	space.reset();
 	for(HiMesh_Wrapper *wr:objects){
 		assert(wr->type == COMPRESSED);
 		HiMesh *nmesh = wr->get_mesh();
+		object_entry entry;
+		entry.offset = offset;
+		entry.box.set_box(wr->box);
 		//tdbase::write_polyhedron(&shifted, ids++);
 		size_t size = nmesh->get_data_size();
 		os->write((char *)&size, sizeof(size_t));
 		os->write(nmesh->get_data(), nmesh->get_data_size());
+		offset += sizeof(size_t) + size;
 		size = wr->voxels.size();
 		os->write((char *)&size, sizeof(size_t));
 		for(Voxel *v:wr->voxels){
@@ -65,7 +368,12 @@ void Tile::dump_compressed(const char *path){
 			os->write((char *)v->high, 3*sizeof(float));
 			os->write((char *)v->core, 3*sizeof(float));
 		}
+		offset += sizeof(size_t) + size*9*sizeof(float);
+		entry.length = offset - entry.offset;
+		entries.push_back(entry);
+		space.update(wr->box);
 	}
+	dump_footer(os, offset);
 	os->close();
 }
 
@@ -78,10 +386,16 @@ void Tile::dump_raw(const char *path){
 	size_t offset = 0;
 	buffer[0] = (char)RAW;
 	offset++;
+	entries.clear();
+	space.reset();
 
 	for(HiMesh_Wrapper *wr:objects){
 		assert(wr->type != RAW && "already be in raw format");
 
+		object_entry entry;
+		entry.offset = offset;
+		entry.box.set_box(wr->box);
+
 		size_t *dsize_holder = (size_t *)(buffer+offset);
 		offset += sizeof(size_t);
 
@@ -138,9 +452,13 @@ void Tile::dump_raw(const char *path){
 				offset += sizeof(size_t);
 			}
 		}
+		entry.length = offset - entry.offset;
+		entries.push_back(entry);
+		space.update(wr->box);
 	}
 
 	os->write(buffer, offset);
+	dump_footer(os, offset);
 	os->close();
 	delete os;
 	delete []buffer;
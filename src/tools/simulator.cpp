@@ -285,6 +285,7 @@ int main(int argc, char **argv){
 	pthread_mutex_init(&mylock, NULL);
 
 	int cm = HiMesh::calculate_method;
+	string hausdorff_storage = "byte";
 	po::options_description desc("joiner usage");
 	desc.add_options()
 		("help,h", "produce help message")
@@ -300,6 +301,8 @@ int main(int argc, char **argv){
 		("vs", po::value<int>(&voxel_size), "number of vertices in each voxel")
 		("verbose", po::value<int>(&global_ctx.verbose), "verbose level")
 		("sample_rate,r", po::value<uint32_t>(&HiMesh::sampling_rate), "sampling rate for Hausdorff distance calculation (default 30)")
+		("qbits", po::value<uint32_t>(&HiMesh::quantization_bits_setting), "number of bits for quantizing the vertex coordinates, at most 20 (default 0 for lossless)")
+		("hausdorff_storage", po::value<string>(&hausdorff_storage), "how the Hausdorff distances are stored [byte(default)|float|both]")
 		("calculate_method", po::value<int>(&cm), "hausdorff distance calculating method [0NULL|1BVH(default)|2ASSOCIATE|3ASSOCIATE_CYLINDER]")
 		;
 	HiMesh::calculate_method = (Hausdorff_Computing_Type)cm;
@@ -313,6 +316,17 @@ int main(int argc, char **argv){
 	}
 	po::notify(vm);
 
+	if(hausdorff_storage == "byte"){
+		HiMesh::hausdorff_storage_setting = HIMESH_FLAG_HAUSDORFF_BYTE;
+	}else if(hausdorff_storage == "float"){
+		HiMesh::hausdorff_storage_setting = HIMESH_FLAG_HAUSDORFF_FLOAT;
+	}else if(hausdorff_storage == "both"){
+		HiMesh::hausdorff_storage_setting = HIMESH_FLAG_HAUSDORFF_BYTE|HIMESH_FLAG_HAUSDORFF_FLOAT;
+	}else{
+		cout<<desc<<endl;
+		return 0;
+	}
+
 	if(vm.count("ppvp")){
 		global_ctx.ppvp = true;
 	}
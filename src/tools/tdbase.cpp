@@ -441,7 +441,9 @@ static void intersect(int argc, char **argv){
 static void print(int argc, char **argv){
 	assert(argc>1);
 	int num = argc > 2 ? atoi(argv[2]) : 0;
-	Tile *tile = new Tile(argv[1],num+1);
+	// only the footer and the requested object are read
+	Tile *tile = new Tile(argv[1],num+1,false);
+	tile->open();
 	assert(tile->num_objects()>num);
 	int lod = argc>3?atoi(argv[3]):100;
 	tile->get_mesh(num)->decode(lod);
@@ -564,6 +566,9 @@ static void join(int argc, char **argv){
 	}
 
 	HiMesh::use_byte_coding = !global_ctx.disable_byte_encoding;
+	if(global_ctx.cache_size > 0){
+		global_ctx.cache = new mesh_cache(global_ctx.cache_size*1024*1024);
+	}
 
 	char path1[256];
 	char path2[256];
@@ -615,6 +620,121 @@ static void join(int argc, char **argv){
 	logt("clearing tiles", start);
 	delete joiner;
 	delete gc;
+	if(global_ctx.cache){
+		delete global_ctx.cache;
+		global_ctx.cache = NULL;
+	}
+}
+
+/*
+ * check the batched TriDist kernel against the scalar one
+ * with random triangles and compare their speed
+ * */
+static void profile_tridist(int argc, char **argv){
+	size_t num = 1000000;
+	if(argc>1){
+		num = atoi(argv[1]);
+	}
+	const int W = TriDist_batch_width();
+	num = (num+W-1)/W*W;
+	float *S = new float[9];
+	float *T = new float[num*9];
+	for(int k=0;k<9;k++){
+		S[k] = get_rand_double()*10;
+	}
+	for(size_t i=0;i<num*9;i++){
+		T[i] = get_rand_double()*10;
+	}
+	const size_t stride = (num+TRIDIST_MAX_WIDTH-1)/TRIDIST_MAX_WIDTH*TRIDIST_MAX_WIDTH;
+	float *T_soa = new float[9*stride];
+	TriDist_transpose(T, num, stride, T_soa);
+	float *dist_batch = new float[num];
+	float *dist_scalar = new float[num];
+
+	struct timeval start = get_cur_time();
+	for(size_t i=0;i<num;i+=W){
+		TriDist_batch(S, T_soa+i, stride, W, dist_batch+i);
+	}
+	logt("batched TriDist with %d lanes", start, W);
+	for(size_t i=0;i<num;i++){
+		dist_scalar[i] = TriDist(S, T+i*9);
+	}
+	logt("scalar TriDist", start);
+
+	size_t mismatch = 0;
+	for(size_t i=0;i<num;i++){
+		if(dist_batch[i]!=dist_scalar[i]){
+			mismatch++;
+		}
+	}
+	log("%ld out of %ld distances mismatch", mismatch, num);
+
+	delete []S;
+	delete []T;
+	delete []T_soa;
+	delete []dist_batch;
+	delete []dist_scalar;
+}
+
+/*
+ * compare the octree and the STR tree over the objects of tile2 with the
+ * intersect, within and knn queries of the objects in tile1
+ * usage: profile_index tile1 tile2 [k] [within_dist]
+ * */
+static void profile_index(int argc, char **argv){
+	if(argc<3){
+		cout<<"usage: profile_index tile1 tile2 [k] [within_dist]"<<endl;
+		return;
+	}
+	const int k = argc>3 ? atoi(argv[3]) : 1;
+	const float within_dist = argc>4 ? atof(argv[4]) : 50;
+	Tile *tile1 = new Tile(argv[1]);
+	Tile *tile2 = new Tile(argv[2]);
+	vector<weighted_aab *> boxes;
+	for(int i=0;i<tile2->num_objects();i++){
+		boxes.push_back(&tile2->get_mesh_wrapper(i)->box);
+	}
+
+	struct timeval start = get_cur_time();
+	OctreeNode *octree = build_octree(boxes, OCTREE_LEAF_SIZE);
+	logt("build octree", start);
+	STRTree *strtree = new STRTree(boxes);
+	logt("build STR tree with %ld nodes", start, strtree->num_nodes());
+
+	ObjectIndex *indexes[2] = {octree, strtree};
+	const char *names[2] = {"octree", "STR tree"};
+	size_t found[2][3] = {{0}};
+	for(int t=0;t<2;t++){
+		for(int i=0;i<tile1->num_objects();i++){
+			vector<int> ids;
+			indexes[t]->query_intersect(&tile1->get_mesh_wrapper(i)->box, ids);
+			// the octree returns duplicates
+			std::sort(ids.begin(), ids.end());
+			found[t][0] += std::unique(ids.begin(), ids.end())-ids.begin();
+		}
+		logt("%s: intersect found %ld", start, names[t], found[t][0]);
+		for(int i=0;i<tile1->num_objects();i++){
+			vector<pair<int, range>> results;
+			indexes[t]->query_within(&tile1->get_mesh_wrapper(i)->box, results, within_dist);
+			found[t][1] += results.size();
+		}
+		logt("%s: within %.2f found %ld", start, names[t], within_dist, found[t][1]);
+		for(int i=0;i<tile1->num_objects();i++){
+			vector<pair<int, range>> results;
+			float min_maxdist = DBL_MAX;
+			indexes[t]->query_knn(&tile1->get_mesh_wrapper(i)->box, results, min_maxdist, k);
+			found[t][2] += results.size();
+		}
+		logt("%s: %dnn found %ld", start, names[t], k, found[t][2]);
+	}
+	if(found[0][0]!=found[1][0] || found[0][1]!=found[1][1] || found[0][2]!=found[1][2]){
+		log("the results of the two indexes differ");
+	}
+
+	delete octree;
+	delete strtree;
+	delete tile1;
+	delete tile2;
 }
 
 static void test(int argc, char **argv){
@@ -693,6 +813,10 @@ int main(int argc, char **argv){
 		profile_distance(argc-1,argv+1);
 	}else if(strcmp(argv[1],"profile_decoding") == 0){
 		profile_decoding(argc-1,argv+1);
+	}else if(strcmp(argv[1],"profile_tridist") == 0){
+		profile_tridist(argc-1,argv+1);
+	}else if(strcmp(argv[1],"profile_index") == 0){
+		profile_index(argc-1,argv+1);
 	}else if(strcmp(argv[1],"aabb") == 0){
 		aabb(argc-1,argv+1);
 	}else if(strcmp(argv[1],"adjust_polyhedron") == 0){
@@ -730,7 +854,7 @@ int main(int argc, char **argv){
 	}else if(strcmp(argv[1],"hausdorff") == 0){
 		hausdorff(argc-1,argv+1);
 	}else{
-		cout<<"usage: 3dpro himesh_to_wkt|profile_protruding|get_voxel_boxes|profile_distance|profile_decoding|adjust_polyhedron|skeleton|voxelize [args]"<<endl;
+		cout<<"usage: 3dpro himesh_to_wkt|profile_protruding|get_voxel_boxes|profile_distance|profile_decoding|profile_tridist|profile_index|adjust_polyhedron|skeleton|voxelize [args]"<<endl;
 		exit(0);
 	}
 